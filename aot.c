@@ -0,0 +1,312 @@
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "aot.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "quirks.h"
+#include "replay.h"
+
+static void Cover(AOT_RUNTIME *aot, const AOT_BLOCK *block, int delta)
+{
+    unsigned a;
+    for(a=block->start; a < block->end; a++)
+        aot->coverage[a] += delta;
+}
+
+void AttachAot(AOT_RUNTIME *aot, const AOT_PROGRAM *program, const CHIP8 *c8)
+{
+    unsigned i, b;
+    aot->program = program;
+    for(i=0; i < 0x1000; i++)
+        aot->block_at[i] = NO_AOT_BLOCK;
+    memset(aot->coverage, 0, sizeof(aot->coverage));
+    aot->compiled_instructions = 0;
+    aot->interpreted_instructions = 0;
+    aot->invalidations = 0;
+    for(b=0; b < program->block_count; b++)
+    {
+        const AOT_BLOCK *block = &program->blocks[b];
+        bool same = block->end <= 0x200 + program->size;
+        for(i=block->start; same && i < block->end; i++)
+            same = c8->MEMORY[i] == program->rom[i - 0x200];
+        if(!same)
+            continue;
+        aot->block_at[block->start] = (int16_t)b;
+        Cover(aot, block, 1);
+    }
+}
+
+void AotStored(AOT_RUNTIME *aot, uint16_t address, unsigned length)
+{
+    unsigned i, b;
+    bool covered = false;
+    //Fast path: stores into data never touch the block list
+    for(i=0; i < length && !covered; i++)
+        covered = aot->coverage[(address + i) & ADDRESS_MASK] != 0;
+    if(!covered)
+        return;
+
+    for(b=0; b < aot->program->block_count; b++)
+    {
+        const AOT_BLOCK *block = &aot->program->blocks[b];
+        if(aot->block_at[block->start] != (int16_t)b)
+            continue;
+        for(i=0; i < length; i++)
+        {
+            unsigned a = (address + i) & ADDRESS_MASK;
+            if(a >= block->start && a < block->end)
+            {
+                aot->block_at[block->start] = NO_AOT_BLOCK;
+                Cover(aot, block, -1);
+                aot->invalidations++;
+                break;
+            }
+        }
+    }
+}
+
+//Execute() one instruction, telling the runtime about the stores it makes
+static bool Interpret(CHIP8 *c8, AOT_RUNTIME *aot)
+{
+    uint16_t opcode = c8->MEMORY[c8->PC & ADDRESS_MASK] << 8 | c8->MEMORY[(c8->PC + 1) & ADDRESS_MASK];
+    uint8_t o = DECODE_TABLE[opcode];
+    uint16_t address = c8->I_REGISTER;
+    unsigned length = 0;
+    if(o != UNKNOWN_INSTRUCTION && INSTRUCTION_SET[o].opcode == 0xF033)
+        length = 3;
+    else if(o != UNKNOWN_INSTRUCTION && INSTRUCTION_SET[o].opcode == 0xF055)
+        length = ((opcode >> 8) & 0xF) + 1;
+    if(!Execute(c8))
+        return false;
+    if(length)
+        AotStored(aot, address, length);
+    return true;
+}
+
+bool RunAot(CHIP8 *c8, AOT_RUNTIME *aot, uint32_t budget, uint32_t *executed)
+{
+    const AOT_BLOCK *blocks = aot->program->blocks;
+    uint32_t done = 0;
+    bool ok = true;
+    while(done < budget && !c8->WAIT_KEY)
+    {
+        uint16_t pc = c8->PC;
+        int b = pc <= ADDRESS_MASK ? aot->block_at[pc] : NO_AOT_BLOCK;
+        //A block only runs whole, one cut short by the budget is interpreted like the jit does
+        if(b != NO_AOT_BLOCK && blocks[b].count <= budget - done)
+        {
+            blocks[b].run(c8, aot);
+            done += blocks[b].count;
+            aot->compiled_instructions += blocks[b].count;
+        }
+        else
+        {
+            ok = Interpret(c8, aot);
+            if(!ok)
+                break;
+            done++;
+            aot->interpreted_instructions++;
+        }
+        if(MAY_CLOSE_IDLE_LOOP(pc, c8->PC))
+            done += SkipIdleLoop(c8, budget - done);
+    }
+    if(executed)
+        *executed = done;
+    return ok;
+}
+
+typedef enum {AOT_ENGINE_INTERPRETER, AOT_ENGINE_BLOCKS, AOT_ENGINE_JIT, AOT_ENGINE_AOT, AOT_ENGINES} AOT_ENGINE;
+static const char *const ENGINE_NAMES[AOT_ENGINES] = {"interpreter", "blocks", "jit", "aot"};
+
+typedef struct {
+    uint64_t cycles;//instruction budget, 0 = no limit
+    uint64_t frames;//frame budget, 0 = no limit
+    uint32_t ips;
+    uint64_t seed;
+    uint16_t keys;//keypad held down for the whole run, bit k = key k
+} AOT_LIMITS;
+
+typedef struct {
+    const char *status;
+    uint64_t instructions;
+    uint64_t frames;
+    double elapsed;
+} AOT_RESULT;
+
+//Monotonic wall clock in seconds
+static double WallTime()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+//Power on `c8` with the program's rom and run it on `engine` the way chip8_headless runs a single job
+static void RunProgram(CHIP8 *c8, AOT_RUNTIME *aot, const AOT_PROGRAM *program, AOT_ENGINE engine, const AOT_LIMITS *limits, AOT_RESULT *result)
+{
+    BLOCK_CACHE *cache = NULL;
+    uint64_t executed = 0;
+    uint64_t frame = 0;
+    unsigned k;
+
+    InitChip8(c8);
+    SeedChip8(c8, limits->seed);
+    SetQuirkProfile(c8, program->quirks);
+    LoadGameFromBuffer(c8, program->rom, program->size);
+    for(k=0; k < 0x10; k++)
+        c8->KEY[k] = (limits->keys >> k) & 0x1;
+    if(engine == AOT_ENGINE_BLOCKS || engine == AOT_ENGINE_JIT)
+    {
+        cache = CreateBlockCache();
+        if(engine == AOT_ENGINE_JIT)
+            cache->jit = CreateJit();
+        AttachBlockCache(c8, cache);
+    }
+    if(engine == AOT_ENGINE_AOT)
+        AttachAot(aot, program, c8);
+
+    result->status = "ok";
+    double start = WallTime();
+    while((limits->frames == 0 || frame < limits->frames) && (limits->cycles == 0 || executed < limits->cycles))
+    {
+        uint32_t budget = FrameInstructionBudget(limits->ips, frame);
+        uint32_t ran = 0;
+        if(limits->cycles && limits->cycles - executed < budget)
+            budget = (uint32_t)(limits->cycles - executed);
+        bool ok = engine == AOT_ENGINE_AOT ? RunAot(c8, aot, budget, &ran) : RunFrame(c8, budget, &ran);
+        executed += ran;
+        if(!ok) { result->status = "unknown_opcode"; break; }
+        if(c8->WAIT_KEY) { result->status = "waiting_for_key"; break; }
+        TickTimers(c8);
+        frame++;
+    }
+    result->elapsed = WallTime() - start;
+    result->instructions = executed;
+    result->frames = frame;
+
+    if(cache)
+    {
+        c8->block_cache = NULL;
+        DestroyJit(cache->jit);
+        DestroyBlockCache(cache);
+    }
+}
+
+static void PrintAotUsage(const char *exe)
+{
+    printf("Usage: %s [-c cycles] [-f frames] [-i ips] [-R seed] [-k keys] [-e engine] [-b]\n", exe);
+    printf("  -c cycles   stop after this many instructions\n");
+    printf("  -f frames   stop after this many 60Hz frames\n");
+    printf("  -i ips      emulated instructions per second, sets how many run per frame (default %u)\n", DEFAULT_IPS);
+    printf("  -R seed     seed of the 0xC000 random generator (default %u)\n", DEFAULT_SEED);
+    printf("  -k keys     keys held down for the whole run, bit k = key k (default 0)\n");
+    printf("  -e engine   aot (default), or interpreter, blocks or jit to run the embedded rom on the core\n");
+    printf("  -b          run the rom on every engine, report their speed and compare them with the interpreter\n");
+}
+
+int AotMain(const AOT_PROGRAM *program, int argc, char *argv[])
+{
+    AOT_LIMITS limits = {0, 0, DEFAULT_IPS, DEFAULT_SEED, 0};
+    AOT_ENGINE engine = AOT_ENGINE_AOT;
+    bool benchmark = false;
+    int a, e;
+    for(a=1; a < argc; a++)
+    {
+        if(strcmp(argv[a], "-c") == 0 && a + 1 < argc)
+            limits.cycles = strtoull(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-f") == 0 && a + 1 < argc)
+            limits.frames = strtoull(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-i") == 0 && a + 1 < argc)
+            limits.ips = (uint32_t)strtoul(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-R") == 0 && a + 1 < argc)
+            limits.seed = strtoull(argv[++a], NULL, 0);
+        else if(strcmp(argv[a], "-k") == 0 && a + 1 < argc)
+            limits.keys = (uint16_t)strtoul(argv[++a], NULL, 0);
+        else if(strcmp(argv[a], "-e") == 0 && a + 1 < argc)
+        {
+            a++;
+            for(e=0; e < AOT_ENGINES && strcmp(argv[a], ENGINE_NAMES[e]) != 0; e++);
+            if(e == AOT_ENGINES) { PrintAotUsage(argv[0]); return 1; }
+            engine = (AOT_ENGINE)e;
+        }
+        else if(strcmp(argv[a], "-b") == 0)
+            benchmark = true;
+        else { PrintAotUsage(argv[0]); return 1; }
+    }
+    if((limits.cycles == 0 && limits.frames == 0) || limits.ips == 0)
+    {
+        PrintAotUsage(argv[0]);
+        return 1;
+    }
+    if(engine == AOT_ENGINE_JIT && !JIT_SUPPORTED)
+    {
+        fprintf(stderr, "The jit is not available on this host, running blocks\n");
+        engine = AOT_ENGINE_BLOCKS;
+    }
+
+    BuildDecodeTable();
+    static CHIP8 machine, reference;
+    static AOT_RUNTIME aot;
+    AOT_RESULT result;
+
+    if(benchmark)
+    {
+        //The interpreter runs first, every other engine is timed against it and has to end in the same state
+        AOT_RESULT base;
+        bool differ = false;
+        RunProgram(&reference, &aot, program, AOT_ENGINE_INTERPRETER, &limits, &base);
+        printf("rom:          %s (%s)\n", program->name, QuirkProfileName(program->quirks));
+        for(e=0; e < AOT_ENGINES; e++)
+        {
+            const char *field = NULL;
+            if(e == AOT_ENGINE_JIT && !JIT_SUPPORTED)
+                continue;
+            if(e == AOT_ENGINE_INTERPRETER)
+                result = base;
+            else
+            {
+                RunProgram(&machine, &aot, program, (AOT_ENGINE)e, &limits, &result);
+                field = CompareMachines(&machine, &reference);
+                if(field == NULL && result.instructions != base.instructions)
+                    field = "instructions";
+            }
+            double ips = result.elapsed > 0.0 ? (double)result.instructions / result.elapsed : 0.0;
+            double base_ips = base.elapsed > 0.0 ? (double)base.instructions / base.elapsed : 0.0;
+            printf("%-12s  wall time: %.6f s  ips: %12.0f  speedup: %6.2fx  %s%s\n", ENGINE_NAMES[e], result.elapsed, ips,
+                base_ips > 0.0 ? ips / base_ips : 0.0, field ? "differs in " : "same state", field ? field : "");
+            differ |= field != NULL;
+        }
+        printf("instructions: %llu in %llu frames, status %s\n", (unsigned long long)base.instructions, (unsigned long long)base.frames, base.status);
+        return differ ? 46 : 0;
+    }
+
+    RunProgram(&machine, &aot, program, engine, &limits, &result);
+    printf("rom:          %s\n", program->name);
+    printf("rom hash:     %016llx\n", (unsigned long long)HashRom(program->rom, program->size));
+    printf("quirks:       %s\n", QuirkProfileName(program->quirks));
+    printf("engine:       %s\n", ENGINE_NAMES[engine]);
+    printf("status:       %s\n", result.status);
+    printf("instructions: %llu\n", (unsigned long long)result.instructions);
+    printf("frames:       %llu\n", (unsigned long long)result.frames);
+    printf("wall time:    %.6f s\n", result.elapsed);
+    printf("ips:          %.0f\n", result.elapsed > 0.0 ? (double)result.instructions / result.elapsed : 0.0);
+    printf("pc:           0x%03x\n", machine.PC);
+    printf("display hash: %016llx\n", (unsigned long long)HashDisplay(&machine));
+    if(engine == AOT_ENGINE_AOT)
+    {
+        uint64_t total = aot.compiled_instructions + aot.interpreted_instructions;
+        printf("aot:          %u blocks, %.2f%% of instructions recompiled, %llu invalidations\n", program->block_count,
+            total ? 100.0 * (double)aot.compiled_instructions / (double)total : 0.0, (unsigned long long)aot.invalidations);
+    }
+    return strcmp(result.status, "unknown_opcode") == 0 ? 45 : 0;
+}
@@ -0,0 +1,58 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "chip8.h"
+
+//Runtime of roms recompiled ahead of time by chip8_aot (recompiler.c). The recompiler walks the code reachable from
+//0x200 and turns every basic block into a C function: simple instructions become plain C, the rest calls its
+//chip8_func_* handler with constant operands. Blocks split like the block cache's (see EndsBlock()), so a frame runs
+//them with the same budget and idle loop rules and leaves the machine exactly as the interpreter would. Addresses
+//without a block, like the targets of 0xB000, and blocks whose bytes were overwritten run on Execute() instead.
+
+#define NO_AOT_BLOCK -1
+
+struct AOT_RUNTIME;
+typedef void (*AOT_FUNC)(CHIP8 *c8, struct AOT_RUNTIME *aot);
+
+typedef struct {
+    uint16_t start;//first byte of the block
+    uint16_t end;//one past the last byte of the block
+    uint16_t count;//number of instructions
+    AOT_FUNC run;
+} AOT_BLOCK;
+
+//Everything a generated translation unit describes
+typedef struct {
+    const char *name;//rom the program was recompiled from
+    const uint8_t *rom;
+    size_t size;
+    QUIRK_PROFILE quirks;//profile the blocks were specialized for
+    const AOT_BLOCK *blocks;
+    unsigned block_count;
+} AOT_PROGRAM;
+
+typedef struct AOT_RUNTIME {
+    const AOT_PROGRAM *program;
+    int16_t block_at[0x1000];//block starting at each address, or NO_AOT_BLOCK
+    uint8_t coverage[0x1000];//number of live blocks covering each byte
+    //Statistics
+    uint64_t compiled_instructions;//instructions retired by recompiled blocks
+    uint64_t interpreted_instructions;//instructions that fell back to Execute()
+    uint64_t invalidations;//blocks dropped because memory under them was written
+} AOT_RUNTIME;
+
+//Generated code: run a handler on a constant instruction, PC already past it like Execute() leaves it
+#define AOT_OPERANDS(c8, opcode) ((c8)->operands = DecodeOperands(opcode).packed)
+#define AOT_CALL(c8, opcode, next, handler) (AOT_OPERANDS(c8, opcode), (c8)->PC = (next), handler(c8))
+
+//Use the blocks of `program` for `c8`, call after loading the rom or a state. Blocks whose bytes in memory differ
+//from the rom they were compiled from are left out
+void AttachAot(AOT_RUNTIME *aot, const AOT_PROGRAM *program, const CHIP8 *c8);
+//Memory in [address, address + length) was written, drop every block that overlaps it
+void AotStored(AOT_RUNTIME *aot, uint16_t address, unsigned length);
+//Same contract as RunFrame(), running recompiled blocks wherever it can
+bool RunAot(CHIP8 *c8, AOT_RUNTIME *aot, uint32_t budget, uint32_t *executed);
+//main() of a recompiled rom: runs it headless like chip8_headless, or benchmarks it against the other engines
+int AotMain(const AOT_PROGRAM *program, int argc, char *argv[]);
+
+#endif
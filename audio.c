@@ -0,0 +1,100 @@
+#include "audio.h"
+
+#define COS_TABLE_STEP 0.99969881869620422//cos(2 * pi / WAVETABLE_SIZE)
+#define SIN_TABLE_STEP 0.02454122852291229//sin(2 * pi / WAVETABLE_SIZE)
+
+void InitBeeper(BEEPER *beeper, unsigned rate, unsigned latency)
+{
+    unsigned i;
+    double s = 0.0, c = 1.0;
+    memset(beeper, 0, sizeof(BEEPER));
+    atomic_init(&beeper->head, 0);
+    atomic_init(&beeper->tail, 0);
+    //One sine period by rotating a unit vector, the audio thread never calls into libm
+    for(i=0; i < WAVETABLE_SIZE; i++)
+    {
+        beeper->wavetable[i] = (uint8_t)(AUDIO_SILENCE + (int)(s * BEEP_VOLUME));
+        double next_s = s * COS_TABLE_STEP + c * SIN_TABLE_STEP;
+        c = c * COS_TABLE_STEP - s * SIN_TABLE_STEP;
+        s = next_s;
+    }
+    beeper->rate = rate;
+    beeper->latency = latency;
+    beeper->step = (uint32_t)(((uint64_t)BEEP_FREQUENCY << 32) / rate);
+}
+
+void BeeperTimer(BEEPER *beeper, uint8_t sound_timer, uint64_t frame)
+{
+    bool on = sound_timer > 0;
+    if(on == beeper->producer_on)
+        return;
+    unsigned tail = atomic_load_explicit(&beeper->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&beeper->head, memory_order_acquire);
+    if(tail - head == AUDIO_QUEUE_SIZE)
+    {
+        //The audio thread stalled, try again next frame
+        beeper->dropped++;
+        return;
+    }
+    AUDIO_EDGE *edge = &beeper->edges[tail & (AUDIO_QUEUE_SIZE - 1)];
+    edge->time = frame * beeper->rate / TIMER_HZ;
+    edge->on = on;
+    atomic_store_explicit(&beeper->tail, tail + 1, memory_order_release);
+    beeper->producer_on = on;
+}
+
+//Output sample the next queued edge plays at, or UINT64_MAX when the queue is empty
+static uint64_t NextEdge(BEEPER *beeper, unsigned head, unsigned count)
+{
+    if(head == atomic_load_explicit(&beeper->tail, memory_order_acquire))
+        return UINT64_MAX;
+    const AUDIO_EDGE *edge = &beeper->edges[head & (AUDIO_QUEUE_SIZE - 1)];
+    int64_t at = (int64_t)edge->time + beeper->delay;
+    //Emulated and output time drift apart (stalls, catch-up frames, a different clock): lock them again,
+    //edges that were already in step keep their exact spacing
+    if(!beeper->synced || at < (int64_t)beeper->clock || at > (int64_t)(beeper->clock + count + beeper->latency + beeper->rate / 10))
+    {
+        beeper->delay = (int64_t)(beeper->clock + beeper->latency) - (int64_t)edge->time;
+        beeper->synced = true;
+        at = (int64_t)edge->time + beeper->delay;
+    }
+    return (uint64_t)at;
+}
+
+void RenderBeeper(BEEPER *beeper, uint8_t *out, unsigned count)
+{
+    unsigned head = atomic_load_explicit(&beeper->head, memory_order_relaxed);
+    uint64_t edge_at = NextEdge(beeper, head, count);
+    unsigned i = 0;
+    while(i < count)
+    {
+        //Apply every edge due at this sample
+        while(edge_at <= beeper->clock)
+        {
+            beeper->on = beeper->edges[head & (AUDIO_QUEUE_SIZE - 1)].on;
+            //Start every beep at a zero crossing
+            if(beeper->on)
+                beeper->phase = 0;
+            head++;
+            atomic_store_explicit(&beeper->head, head, memory_order_release);
+            edge_at = NextEdge(beeper, head, count - i);
+        }
+        //Render up to the next edge in one run
+        unsigned run = count - i;
+        if(edge_at - beeper->clock < run)
+            run = (unsigned)(edge_at - beeper->clock);
+        if(beeper->on)
+        {
+            unsigned k;
+            for(k=0; k < run; k++)
+            {
+                out[i + k] = beeper->wavetable[beeper->phase >> 24];
+                beeper->phase += beeper->step;
+            }
+        }
+        else
+            memset(out + i, AUDIO_SILENCE, run);
+        i += run;
+        beeper->clock += run;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdatomic.h>
+#include "chip8.h"
+
+//Beeper driven by sound_timer edges. The emulation thread pushes an edge every time the timer starts or stops
+//counting, stamped with the emulated sample it happened at, through a lock-free single producer/single consumer
+//queue. The audio thread renders unsigned 8-bit mono from a wavetable and applies every edge at its sample,
+//so a beep lasts exactly sound_timer/60 seconds and starts within one buffer of the frame that set it.
+
+#define AUDIO_RATE 44100
+#define AUDIO_MIN_BUFFER 256
+#define AUDIO_MAX_BUFFER 512
+#ifndef AUDIO_BUFFER_SAMPLES
+#define AUDIO_BUFFER_SAMPLES 512
+#endif
+#define BEEP_FREQUENCY 800//Hz
+#define BEEP_VOLUME 96//peak distance from silence, out of 127
+#define AUDIO_SILENCE 0x80
+#define WAVETABLE_SIZE 256//one sine period, indexed by the top 8 bits of the phase
+#define AUDIO_QUEUE_SIZE 64//pending edges, must be a power of two
+
+typedef struct {
+    uint64_t time;//emulated sample the edge happened at
+    bool on;
+} AUDIO_EDGE;
+
+typedef struct {
+    //Emulation thread
+    bool producer_on;//state of the last pushed edge
+    uint64_t dropped;//edges lost to a full queue
+    char producer_padding[64];
+
+    //Queue: the producer only writes tail, the consumer only writes head
+    AUDIO_EDGE edges[AUDIO_QUEUE_SIZE];
+    atomic_uint head;
+    char head_padding[64];
+    atomic_uint tail;
+    char tail_padding[64];
+
+    //Audio thread
+    uint8_t wavetable[WAVETABLE_SIZE];
+    uint32_t phase;
+    uint32_t step;//phase increment per sample, 2^32 * frequency / rate
+    uint64_t clock;//samples rendered so far
+    int64_t delay;//output sample of an edge = edge time + delay
+    bool synced;
+    bool on;
+    unsigned rate;
+    unsigned latency;//samples between an edge and its earliest playback
+} BEEPER;
+
+//`latency` is the slack given to edges so their spacing survives host jitter, one buffer for a sound card, 0 offline
+void InitBeeper(BEEPER *beeper, unsigned rate, unsigned latency);
+//Emulation thread, once per frame before TickTimers(): queues an edge if the sound timer started or stopped
+void BeeperTimer(BEEPER *beeper, uint8_t sound_timer, uint64_t frame);
+//Audio thread: fill `out` with the next `count` samples
+void RenderBeeper(BEEPER *beeper, uint8_t *out, unsigned count);
+
+#endif
@@ -0,0 +1,206 @@
+#include "blockcache.h"
+#include "jit.h"
+#include "profiler.h"
+
+BLOCK_CACHE *CreateBlockCache()
+{
+    BLOCK_CACHE *cache = (BLOCK_CACHE*)calloc(1, sizeof(BLOCK_CACHE));
+    if(cache)
+        ResetBlockCache(cache);
+    return cache;
+}
+
+void DestroyBlockCache(BLOCK_CACHE *cache)
+{
+    free(cache);
+}
+
+void ResetBlockCache(BLOCK_CACHE *cache)
+{
+    unsigned i;
+    for(i=0; i < 0x1000; i++)
+        cache->block_at[i] = NO_BLOCK;
+    memset(cache->coverage, 0, sizeof(cache->coverage));
+    cache->block_count = 0;
+    cache->code_used = 0;
+    if(cache->jit)
+        ResetJit(cache->jit);
+}
+
+void AttachBlockCache(CHIP8 *c8, BLOCK_CACHE *cache)
+{
+    ResetBlockCache(cache);
+    c8->block_cache = cache;
+}
+
+bool EndsBlock(uint32_t instruction)
+{
+    switch(instruction)
+    {
+        case 0x00EE: case 0x1000: case 0x2000: case 0x3000: case 0x4000: case 0x5000:
+        case 0x9000: case 0xB000: case 0xE09E: case 0xE0A1:
+        case 0xF00A: case 0xF033: case 0xF055:
+            return true;
+    }
+    return false;
+}
+
+static void Cover(BLOCK_CACHE *cache, const CACHED_BLOCK *block, int delta)
+{
+    unsigned a;
+    for(a=block->start; a < block->end; a++)
+        cache->coverage[a] += delta;
+}
+
+//Decode the block starting at `start`, returns its index or NO_BLOCK if the first instruction is unknown
+static int BuildBlock(BLOCK_CACHE *cache, const CHIP8 *c8, uint16_t start)
+{
+    if(cache->block_count == MAX_CACHED_BLOCKS || cache->code_used + MAX_BLOCK_LENGTH > MAX_CACHED_INSTRUCTIONS)
+    {
+        ResetBlockCache(cache);
+        cache->flushes++;
+    }
+
+    CACHED_BLOCK *block = &cache->blocks[cache->block_count];
+    CACHED_INSTRUCTION *code = &cache->code[cache->code_used];
+    unsigned count = 0;
+    unsigned address = start;
+    //Blocks never wrap around the end of memory
+    while(count < MAX_BLOCK_LENGTH && address + 1 < 0x1000)
+    {
+        uint16_t opcode = c8->MEMORY[address] << 8 | c8->MEMORY[address + 1];
+        uint8_t o = DECODE_TABLE[opcode];
+        //Leave unknown opcodes to Execute() so they are reported
+        if(o == UNKNOWN_INSTRUCTION)
+            break;
+        code[count].operands = DecodeOperands(opcode).packed;
+        code[count].func_ptr = INSTRUCTION_SETS[c8->quirks][o].func_ptr;
+        count++;
+        address += 2;
+        if(EndsBlock(INSTRUCTION_SET[o].opcode))
+            break;
+    }
+    if(count == 0)
+        return NO_BLOCK;
+
+    block->start = start;
+    block->end = (uint16_t)address;
+    block->count = (uint16_t)count;
+    block->valid = true;
+    block->first = cache->code_used;
+    block->heat = 0;
+    block->native = NULL;
+    Cover(cache, block, 1);
+    cache->code_used += count;
+    cache->block_at[start] = (int16_t)cache->block_count;
+    cache->blocks_built++;
+    return (int)cache->block_count++;
+}
+
+void InvalidateCode(BLOCK_CACHE *cache, uint16_t address, unsigned length)
+{
+    unsigned i, b;
+    bool covered = false;
+    //Fast path: stores into data never touch the block list
+    for(i=0; i < length && !covered; i++)
+        covered = cache->coverage[(address + i) & ADDRESS_MASK] != 0;
+    if(!covered)
+        return;
+
+    for(b=0; b < cache->block_count; b++)
+    {
+        CACHED_BLOCK *block = &cache->blocks[b];
+        if(!block->valid)
+            continue;
+        for(i=0; i < length; i++)
+        {
+            unsigned a = (address + i) & ADDRESS_MASK;
+            if(a >= block->start && a < block->end)
+            {
+                block->valid = false;
+                cache->block_at[block->start] = NO_BLOCK;
+                Cover(cache, block, -1);
+                cache->invalidations++;
+                break;
+            }
+        }
+    }
+}
+
+bool StepBlock(CHIP8 *c8, uint32_t budget, uint32_t *executed)
+{
+    BLOCK_CACHE *cache = c8->block_cache;
+    uint16_t pc = c8->PC & ADDRESS_MASK;
+    int b = cache->block_at[pc];
+    cache->lookups++;
+    if(b == NO_BLOCK)
+    {
+        b = BuildBlock(cache, c8, pc);
+        if(b == NO_BLOCK)
+        {
+            //Unknown opcode or a block that would wrap, let the interpreter deal with it
+            bool ok = Execute(c8);
+            *executed = ok ? 1 : 0;
+            return ok;
+        }
+    }
+    else
+        cache->hits++;
+
+    CACHED_BLOCK *block = &cache->blocks[b];
+    uint32_t n = block->count;
+    if(n > budget)
+        n = budget;
+    *executed = n;
+
+    if(cache->jit && block->native == NULL && ++block->heat == JIT_THRESHOLD)
+    {
+        block->native = CompileBlock(cache->jit, block->start, &cache->code[block->first], block->count, QUIRK_FLAGS[c8->quirks]);
+        if(block->native == NULL)
+        {
+            //Arena full: start over, the block is decoded and compiled again once it gets hot
+            ResetBlockCache(cache);
+            cache->flushes++;
+            b = BuildBlock(cache, c8, pc);
+            block = &cache->blocks[b];
+        }
+    }
+
+    PROFILE_BLOCK(c8, block->start, &cache->code[block->first], n);
+    //Native code always runs whole blocks from their first byte, a cut short or unmasked entry is interpreted
+    if(block->native && n == block->count && c8->PC == block->start)
+    {
+        block->native(c8);
+        return true;
+    }
+
+    const CACHED_INSTRUCTION *in = &cache->code[block->first];
+    uint32_t i;
+    for(i=0; i < n; i++)
+    {
+        c8->operands = in[i].operands;
+        c8->PC += 2;
+        in[i].func_ptr(c8);//run instruction
+    }
+    return true;
+}
+
+bool RunBlocks(CHIP8 *c8, uint32_t budget, uint32_t *executed)
+{
+    uint32_t done = 0;
+    bool ok = true;
+    while(done < budget && !c8->WAIT_KEY)
+    {
+        uint32_t n;
+        uint16_t pc = c8->PC;
+        ok = StepBlock(c8, budget - done, &n);
+        done += n;
+        if(!ok)
+            break;
+        if(MAY_CLOSE_IDLE_LOOP(pc, c8->PC))
+            done += SkipIdleLoop(c8, budget - done);
+    }
+    if(executed)
+        *executed = done;
+    return ok;
+}
@@ -0,0 +1,66 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "chip8.h"
+
+//Predecoded basic blocks: straight runs of instructions, keyed by their start address, that end at the first
+//jump, call, return, skip, 0xF00A or memory store. Each entry carries its handler and pre-extracted operands,
+//so running a block never fetches or decodes. Stores into a cached block (0xF033, 0xF055, loading a rom)
+//invalidate every block they overlap, so self-modifying roms stay correct.
+
+#define MAX_BLOCK_LENGTH 64
+#define MAX_CACHED_BLOCKS 1024
+#define MAX_CACHED_INSTRUCTIONS (MAX_CACHED_BLOCKS * 8)
+#define NO_BLOCK -1
+
+typedef struct {
+    uint64_t operands;
+    INSTRUCTION_FUNC func_ptr;
+} CACHED_INSTRUCTION;
+
+typedef void (*NATIVE_BLOCK)(CHIP8 *c8);
+
+typedef struct {
+    uint16_t start;//first byte of the block
+    uint16_t end;//one past the last byte of the block
+    uint16_t count;//number of instructions
+    bool valid;
+    uint32_t first;//index of the first instruction in BLOCK_CACHE.code
+    uint32_t heat;//times the block was entered, it is compiled when this reaches JIT_THRESHOLD
+    NATIVE_BLOCK native;//compiled block or NULL
+} CACHED_BLOCK;
+
+typedef struct BLOCK_CACHE {
+    int16_t block_at[0x1000];//block starting at each address, or NO_BLOCK
+    uint8_t coverage[0x1000];//number of valid blocks covering each byte
+    CACHED_BLOCK blocks[MAX_CACHED_BLOCKS];
+    unsigned block_count;
+    CACHED_INSTRUCTION code[MAX_CACHED_INSTRUCTIONS];
+    unsigned code_used;
+    struct JIT *jit;//optional native backend for hot blocks (see jit.h)
+    //Statistics, kept across resets
+    uint64_t lookups;//blocks entered
+    uint64_t hits;//blocks entered that were already decoded
+    uint64_t blocks_built;
+    uint64_t invalidations;//blocks dropped because memory under them was written
+    uint64_t flushes;//times the whole cache was dropped because it was full
+} BLOCK_CACHE;
+
+//Control flow, 0xF00A and stores end a block: the next address is only known at run time,
+//or the store may rewrite the block that is running. Takes the INSTRUCTION_SET opcode, not the raw one
+bool EndsBlock(uint32_t instruction);
+BLOCK_CACHE *CreateBlockCache();
+void DestroyBlockCache(BLOCK_CACHE *cache);
+//Drop every block, statistics are kept
+void ResetBlockCache(BLOCK_CACHE *cache);
+//Empty the cache and make the machine run through it, call after loading the rom
+void AttachBlockCache(CHIP8 *c8, BLOCK_CACHE *cache);
+//Memory in [address, address + length) was written, drop every block that overlaps it
+void InvalidateCode(BLOCK_CACHE *cache, uint16_t address, unsigned length);
+//Run the block at PC, or just the first `budget` instructions of it, natively if it was compiled.
+//Returns false on an unknown opcode, `executed` receives the instructions retired
+bool StepBlock(CHIP8 *c8, uint32_t budget, uint32_t *executed);
+//Same contract as RunFrame(), running cached blocks instead of single instructions
+bool RunBlocks(CHIP8 *c8, uint32_t budget, uint32_t *executed);
+
+#endif
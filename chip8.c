@@ -0,0 +1,554 @@
+#include "chip8.h"
+#include "blockcache.h"
+#include "profiler.h"
+#if defined(__AVX2__) && !defined(CHIP8_NO_SIMD)
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(CHIP8_NO_SIMD)
+#include <emmintrin.h>
+#endif
+
+uint8_t chip8_fontset[80] = 
+{ 
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F 
+};
+
+//SUPER-CHIP 1.1 only has the digits, A-F follow Octo
+uint8_t chip8_big_fontset[160] =
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+bool LoadGame(CHIP8 *c8, const char *filename) {
+    FILE * file = fopen(filename, "rb");
+    if (NULL == file)
+        return false;
+    fread(&c8->MEMORY[0x200], 1, MAX_GAME_SIZE, file);
+    fclose(file);
+    if(c8->block_cache)
+        InvalidateCode(c8->block_cache, 0x200, MAX_GAME_SIZE);
+    return true;
+};
+
+void LoadGameFromBuffer(CHIP8 *c8, const uint8_t *rom, size_t size) {
+    if(size > MAX_GAME_SIZE)
+        size = MAX_GAME_SIZE;
+    memcpy(&c8->MEMORY[0x200], rom, size);
+    if(c8->block_cache)
+        InvalidateCode(c8->block_cache, 0x200, (unsigned)size);
+};
+
+
+
+//XOR `count` sprite rows onto consecutive display rows, returns a non zero value if any lit pixel was erased
+static uint64_t BlitRows(uint64_t *rows, const uint64_t *sprite, unsigned count)
+{
+    uint64_t collision = 0;
+    unsigned i = 0;
+#if defined(__AVX2__) && !defined(CHIP8_NO_SIMD)
+    //Tall sprites: four rows per step
+    if(count >= 4)
+    {
+        __m256i hit = _mm256_setzero_si256();
+        for(; i + 4 <= count; i += 4)
+        {
+            __m256i d = _mm256_loadu_si256((const __m256i*)&rows[i]);
+            __m256i s = _mm256_loadu_si256((const __m256i*)&sprite[i]);
+            hit = _mm256_or_si256(hit, _mm256_and_si256(d, s));
+            _mm256_storeu_si256((__m256i*)&rows[i], _mm256_xor_si256(d, s));
+        }
+        collision |= !_mm256_testz_si256(hit, hit);
+    }
+#endif
+#if defined(__SSE2__) && !defined(CHIP8_NO_SIMD)
+    if(count - i >= 2)
+    {
+        __m128i hit = _mm_setzero_si128();
+        for(; i + 2 <= count; i += 2)
+        {
+            __m128i d = _mm_loadu_si128((const __m128i*)&rows[i]);
+            __m128i s = _mm_loadu_si128((const __m128i*)&sprite[i]);
+            hit = _mm_or_si128(hit, _mm_and_si128(d, s));
+            _mm_storeu_si128((__m128i*)&rows[i], _mm_xor_si128(d, s));
+        }
+        collision |= _mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) != 0xFFFF;
+    }
+#endif
+    for(; i < count; i++)
+    {
+        collision |= rows[i] & sprite[i];
+        rows[i] ^= sprite[i];
+    }
+    return collision;
+}
+
+//xorshift64*, the top byte of the product is the best mixed
+static inline uint8_t NextRandomByte(CHIP8 *c8)
+{
+    uint64_t x = c8->random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    c8->random_state = x;
+    return (uint8_t)((x * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+#define BIND_INSTRUCTION(o, hasvariant) {(uint32_t)o, hasvariant, chip8_func_##o}
+#define CREATE_INSTRUCTION(o, code) void chip8_func_##o (CHIP8 *c8) code;                                       
+//Quirk dependent instructions get one handler per profile, `code` tests the constant QUIRKS so every copy is branch free
+#define BIND_QUIRK_INSTRUCTION(o, hasvariant, profile) {(uint32_t)o, hasvariant, chip8_func_##o##_##profile}
+#define QUIRK_VARIANT(o, profile, code) void chip8_func_##o##_##profile (CHIP8 *c8) { enum { QUIRKS = QUIRKS_##profile##_FLAGS }; code }
+#define CREATE_QUIRK_INSTRUCTION(o, code) QUIRK_VARIANT(o, DEFAULT, code) QUIRK_VARIANT(o, VIP, code)\
+    QUIRK_VARIANT(o, CHIP48, code) QUIRK_VARIANT(o, SCHIP, code)
+//Implement instruction functions                   
+CREATE_INSTRUCTION(0x00E0, {
+unsigned y;
+for(y=0; y < DISPLAY_HEIGHT; y++)
+    if(c8->DISPLAY[y][0] | c8->DISPLAY[y][1]) c8->dirty_rows |= 1ULL << y;//only rows with lit pixels change
+memset(c8->DISPLAY, 0, DISPLAY_SIZE);c8->draw_flag = true;                              p("Clear screen\n");
+})//clear 
+CREATE_INSTRUCTION(0x00EE, {c8->PC = c8->STACK[--c8->SP & 0xF];                                           p("Return from subroutine PC(%i) = STACK[(%i)]; SP-1(%i)\n", c8->PC, c8->SP, c8->SP);   })//return from subroutine (PC to address on top of the stack, then subtract 1 from the SP)
+//SUPER-CHIP display functions. Rows are contiguous, so a vertical scroll is one block move
+#define MODE_ROWS_MASK(c8) ((c8)->hires ? ALL_ROWS_DIRTY : (1ULL << LORES_HEIGHT) - 1)
+CREATE_INSTRUCTION(0x00C0, {
+unsigned height = MODE_HEIGHT(c8);
+memmove(&c8->DISPLAY[c8->N], &c8->DISPLAY[0], (height - c8->N) * sizeof(c8->DISPLAY[0]));
+memset(&c8->DISPLAY[0], 0, c8->N * sizeof(c8->DISPLAY[0]));
+c8->dirty_rows |= MODE_ROWS_MASK(c8);c8->draw_flag = true;                                p("Scroll down %i\n", c8->N);
+})//scroll the display down n pixels
+CREATE_INSTRUCTION(0x00FB, {
+unsigned y;
+if(c8->hires)
+    for(y=0; y < DISPLAY_HEIGHT; y++)
+    {
+        c8->DISPLAY[y][1] = c8->DISPLAY[y][1] >> 4 | c8->DISPLAY[y][0] << 60;
+        c8->DISPLAY[y][0] >>= 4;
+    }
+else
+    for(y=0; y < LORES_HEIGHT; y++)
+        c8->DISPLAY[y][0] >>= 4;
+c8->dirty_rows |= MODE_ROWS_MASK(c8);c8->draw_flag = true;                                p("Scroll right\n");
+})//scroll the display right 4 pixels
+CREATE_INSTRUCTION(0x00FC, {
+unsigned y;
+if(c8->hires)
+    for(y=0; y < DISPLAY_HEIGHT; y++)
+    {
+        c8->DISPLAY[y][0] = c8->DISPLAY[y][0] << 4 | c8->DISPLAY[y][1] >> 60;
+        c8->DISPLAY[y][1] <<= 4;
+    }
+else
+    for(y=0; y < LORES_HEIGHT; y++)
+        c8->DISPLAY[y][0] <<= 4;
+c8->dirty_rows |= MODE_ROWS_MASK(c8);c8->draw_flag = true;                                p("Scroll left\n");
+})//scroll the display left 4 pixels
+CREATE_INSTRUCTION(0x00FE, {c8->hires = false; memset(c8->DISPLAY, 0, DISPLAY_SIZE); c8->dirty_rows = ALL_ROWS_DIRTY; c8->draw_flag = true;   p("Low resolution\n");})//64x32 mode, clears the display
+CREATE_INSTRUCTION(0x00FF, {c8->hires = true; memset(c8->DISPLAY, 0, DISPLAY_SIZE); c8->dirty_rows = ALL_ROWS_DIRTY; c8->draw_flag = true;    p("High resolution\n");})//128x64 mode, clears the display
+CREATE_INSTRUCTION(0x1000, {c8->PC = c8->NNN;                                                   p("Jump to nnn PC = %i\n", c8->NNN);    })//jmp to nnn (set PC to nnn)
+CREATE_INSTRUCTION(0x2000, {c8->STACK[c8->SP++ & 0xF] = c8->PC;  c8->PC = c8->NNN;                                p("Call subroutine: SP+1(%i);STACK[%i]; PC(%i) = nnn(%i)\n", c8->SP, c8->SP, c8->PC, c8->NNN);  })//call subroutine from nnn (increment the SP, then puts the current PC on top of the stack. PC is set to nnn)
+CREATE_INSTRUCTION(0x3000, {if(c8->V[c8->X] == c8->KK) c8->PC+=2;                                       p("Skip next instr if %i == %i\n", c8->V[c8->X], c8->KK);       })//skip next instruction if(Vx == KK) PC+=2
+CREATE_INSTRUCTION(0x4000, {if(c8->V[c8->X] != c8->KK) c8->PC+=2;                                       p("Skip next instr if %i != %i\n", c8->V[c8->X], c8->KK);       })//skip next instruction if(Vx != KK) PC+=2
+CREATE_INSTRUCTION(0x5000, {if(c8->V[c8->X] == c8->V[c8->Y]) c8->PC+=2;                                     p("Skip next instr if %i == %i\n", c8->V[c8->X], c8->V[c8->Y]);     })//skip next instruction if(Vx == Vy) PC+=2
+CREATE_INSTRUCTION(0x6000, {c8->V[c8->X] = c8->KK;                                                  p("assign V[%i] = %i\n", c8->X, c8->KK);      })//Vx = KK
+CREATE_INSTRUCTION(0x7000, {c8->V[c8->X] += c8->KK;                                                 p("add V[%i] += %i\n", c8->X, c8->KK);      })//Vx += KK
+//Aritmethic functions
+CREATE_INSTRUCTION(0x8000, {c8->V[c8->X] = c8->V[c8->Y];                                                p("V[%i] = V[%i]\n", c8->X, c8->Y);     })//Vx = Vy
+CREATE_QUIRK_INSTRUCTION(0x8001, {c8->V[c8->X] = c8->V[c8->X] | c8->V[c8->Y]; if(QUIRKS & QUIRK_VF_RESET) c8->V[0xF] = 0;      p("assign V[%i] = V[%i] OR V[%i]\n", c8->X, c8->X, c8->Y);     })//Vx = Vx OR Vy
+CREATE_QUIRK_INSTRUCTION(0x8002, {c8->V[c8->X] = c8->V[c8->X] & c8->V[c8->Y]; if(QUIRKS & QUIRK_VF_RESET) c8->V[0xF] = 0;      p("assign V[%i] = V[%i] AND V[%i]\n", c8->X, c8->X, c8->Y);    })//Vx = Vx AND Vy
+CREATE_QUIRK_INSTRUCTION(0x8003, {c8->V[c8->X] = c8->V[c8->X] ^ c8->V[c8->Y]; if(QUIRKS & QUIRK_VF_RESET) c8->V[0xF] = 0;      p("assign V[%i] = V[%i] XOR V[%i]\n", c8->X, c8->X, c8->Y);    })//Vx = Vx XOR Vy
+CREATE_INSTRUCTION(0x8004, {c8->V[0xF] = ((int)c8->V[c8->X] + (int)c8->V[c8->Y] > 255)?1:0;c8->V[c8->X]=c8->V[c8->X]+c8->V[c8->Y];  p("add V[%i] += V[%i]\n", c8->X, c8->Y);   })//Vx += Vy set VF = carry -  If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.
+CREATE_INSTRUCTION(0x8005, {c8->V[0xF] = (c8->V[c8->X] > c8->V[c8->Y]) ? 1 : 0; c8->V[c8->X]=c8->V[c8->X]-c8->V[c8->Y];             p("sub V[%i] -= V[%i]\n", c8->X, c8->Y);    })//Vx -= Vy set VF = NOT borrow - If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
+#define SHIFT_SOURCE ((QUIRKS & QUIRK_SHIFT_VY) ? c8->Y : c8->X)
+CREATE_QUIRK_INSTRUCTION(0x8006, {c8->V[0xF] = c8->V[SHIFT_SOURCE] & 0x1; c8->V[c8->X] = (c8->V[SHIFT_SOURCE] >> 1);        p("shr V[%i]>>1\n", c8->X);     })//Vx >> 1 - If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2. The VIP shifts Vy into Vx
+CREATE_INSTRUCTION(0x8007, {c8->V[0xF] = (c8->V[c8->Y] > c8->V[c8->X]) ? 1 : 0; c8->V[c8->X] = c8->V[c8->Y] - c8->V[c8->X];         p("sub V[%i] = V[%i] - V[%i]\n", c8->X, c8->Y, c8->X);  })//Vx = Vy - Vx - set VF = NOT borrow - If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+CREATE_QUIRK_INSTRUCTION(0x800E, {c8->V[0xF] = (c8->V[SHIFT_SOURCE] >> 7) & 0x1; c8->V[c8->X] = (c8->V[SHIFT_SOURCE] << 1); p("shl V[%i]<<1\n", c8->X);     })//Vx << 1 - If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2. The VIP shifts Vy into Vx
+//Misc functions
+CREATE_INSTRUCTION(0x9000, {if(c8->V[c8->X] != c8->V[c8->Y]) c8->PC+=2;                                     p("Skip next instr if %i != %i\n", c8->V[c8->X], c8->V[c8->Y]);     })//skip next instruction if(Vx != Vy) PC+=2
+CREATE_INSTRUCTION(0xA000, {c8->I_REGISTER = c8->NNN;                                           p("assign I = %i\n", c8->NNN);     })//register I set to NNN
+CREATE_QUIRK_INSTRUCTION(0xB000, {c8->PC = (c8->NNN + c8->V[(QUIRKS & QUIRK_JUMP_VX) ? c8->X : 0]) & ADDRESS_MASK;          p("Jump to %i\n", c8->PC);        })//jmp to location nnn+V0 - PC+=nnn+V[0] - The program counter is set to nnn plus the value of V0, CHIP-48 and SUPER-CHIP add Vx instead
+CREATE_INSTRUCTION(0xC000, {c8->V[c8->X] = NextRandomByte(c8) & c8->KK;                                 p("random byte AND kk assign V[%i] = %i\n", c8->X, c8->V[c8->X]);      })//Vx = random byte AND kk - generates a random number from 0 to 255, which is then ANDed with the value kk. The value is stored in Vx
+CREATE_QUIRK_INSTRUCTION(0xD000, {
+//Every sprite row becomes a display row of DISPLAY_ROW_WORDS words: rotating it into place makes pixels past the right
+//edge wrap to the left, shifting it drops them when clipping. The position itself always wraps
+unsigned width = MODE_WIDTH(c8);
+unsigned height = MODE_HEIGHT(c8);
+unsigned shift = c8->V[c8->X] % width;
+unsigned top = c8->V[c8->Y] % height;
+bool big = c8->N == 0;//0xD__0 draws 16x16
+unsigned rows = big ? 16 : c8->N;
+if((QUIRKS & QUIRK_CLIP) && top + rows > height)
+    rows = height - top;
+uint64_t sprite[16][DISPLAY_ROW_WORDS];
+unsigned byteI;
+for(byteI=0; byteI < rows; byteI++)
+{
+    //Read n bytes, or 16 pairs of bytes, from memory address at register I
+    uint64_t row = big ? (uint64_t)c8->MEMORY[(c8->I_REGISTER + byteI * 2) & ADDRESS_MASK] << 56
+                     | (uint64_t)c8->MEMORY[(c8->I_REGISTER + byteI * 2 + 1) & ADDRESS_MASK] << 48
+                   : (uint64_t)c8->MEMORY[(c8->I_REGISTER + byteI) & ADDRESS_MASK] << 56;
+    if(!c8->hires)
+    {
+        sprite[byteI][0] = shift ? (row >> shift) | ((QUIRKS & QUIRK_CLIP) ? 0 : row << (64 - shift)) : row;
+        sprite[byteI][1] = 0;
+    }
+    else
+    {
+        //A 128-bit rotation, the sprite is at most 16 pixels wide so only shifts past 64 bring pixels around
+        sprite[byteI][0] = shift < 64 ? row >> shift : 0;
+        sprite[byteI][1] = shift == 0 ? 0 : shift < 64 ? row << (64 - shift) : row >> (shift - 64);
+        if(!(QUIRKS & QUIRK_CLIP) && shift > 64)
+            sprite[byteI][0] |= row << (128 - shift);
+    }
+}
+//Only rows that get at least one pixel flipped change
+for(byteI=0; byteI < rows; byteI++)
+    if(sprite[byteI][0] | sprite[byteI][1]) c8->dirty_rows |= 1ULL << ((top + byteI) % height);
+uint64_t collision;
+if(top + rows <= height)
+    collision = BlitRows(c8->DISPLAY[top], sprite[0], rows * DISPLAY_ROW_WORDS);
+else
+{
+    //Rows below the bottom edge wrap to the top
+    unsigned first = height - top;
+    collision = BlitRows(c8->DISPLAY[top], sprite[0], first * DISPLAY_ROW_WORDS);
+    collision |= BlitRows(c8->DISPLAY[0], sprite[first], (rows - first) * DISPLAY_ROW_WORDS);
+}
+//Set collision flag if any pixel was erased
+c8->V[0xF] = collision ? 1 : 0;
+c8->draw_flag = true;                                                                   p("Draw\n");
+})//Display n-byte starting at memory location I at (Vx, Vy), set VF = collision - reads n bytes from memory at the address I, display at (Vx, Vy). Sprites are XORed onto the screen, If this causes pixels to be erased, VF= 1 else VF=0 //sprite wrap around screen unless QUIRK_CLIP
+CREATE_INSTRUCTION(0xE09E, {if(c8->KEY[c8->V[c8->X] & 0xF]) c8->PC+=2;                                    p("Skip next inst if KEY[%i] is down\n", c8->V[c8->X]);})//Skip next instruction if key[Vx] is PRESSED PC+=2
+CREATE_INSTRUCTION(0xE0A1, {if(!c8->KEY[c8->V[c8->X] & 0xF]) c8->PC+=2;                                   p("Skip next inst if KEY[%i] is up\n", c8->V[c8->X]);})//Skip next instruction if key[Vx] is NOT PRESSED PC+=2
+CREATE_INSTRUCTION(0xF007, {c8->V[c8->X] = c8->delay_timer;                                     p("V[%i] = delta_timer(%i)\n", c8->X, c8->delay_timer);})//Vx = delay timer value
+CREATE_INSTRUCTION(0xF00A, {c8->WAIT_KEY = true;                                        p("Wait for a keypress\n");})//Wait for a key press store value of the key in Vx -All execution stops until a key is pressed, then the value of that key is stored in Vx.
+CREATE_INSTRUCTION(0xF015, {c8->delay_timer = c8->V[c8->X];                                     p("delta_timer = V[%i](%i)\n", c8->X, c8->V[c8->X]);})//Delay timer = Vx
+CREATE_INSTRUCTION(0xF018, {c8->sound_timer = c8->V[c8->X];                                     p("sound_timer = V[%i](%i)\n", c8->X, c8->V[c8->X]);})//Sound timer = Vx
+CREATE_INSTRUCTION(0xF01E, {c8->V[0xF] = (c8->V[c8->X] + c8->I_REGISTER > 0xFFF)?1:0; c8->I_REGISTER = c8->I_REGISTER + c8->V[c8->X];   p("I += V[%i](%i)\n", c8->X, c8->V[c8->X]);})//I += Vx; VF is set to 1 when there is a range overflow (I+VX>0xFFF), and to 0 when there isn't.
+CREATE_INSTRUCTION(0xF029, {c8->I_REGISTER = FONTSET_BYTES_PER_CHAR * c8->V[c8->X];             p("I = CharLocation(%i)\n", FONTSET_BYTES_PER_CHAR * c8->V[c8->X]);})//The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx
+CREATE_INSTRUCTION(0xF030, {c8->I_REGISTER = BIG_FONTSET_ADDRESS + BIG_FONTSET_BYTES_PER_CHAR * (c8->V[c8->X] & 0xF);       p("I = BigCharLocation(%i)\n", c8->I_REGISTER);})//I is set to the 8x10 sprite of the digit in Vx
+CREATE_INSTRUCTION(0xF033, {
+    c8->MEMORY[c8->I_REGISTER & ADDRESS_MASK]       = (c8->V[c8->X] % 1000) / 100; // hundred's digit
+    c8->MEMORY[(c8->I_REGISTER+1) & ADDRESS_MASK] = (c8->V[c8->X] % 100) / 10;   // ten's digit
+    c8->MEMORY[(c8->I_REGISTER+2) & ADDRESS_MASK] = (c8->V[c8->X] % 10);         // one's digit              
+    if(c8->block_cache) InvalidateCode(c8->block_cache, c8->I_REGISTER, 3);
+                                                                                    p("Store BCD representation of Vx\n");
+})/*MEMORY the binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1,
+and the least significant digit at I plus 2. (In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I,
+the tens digit at location I+1, and the ones digit at location I+2.)
+Store BCD representation of Vx in memory locations I, I+1, and I+2.
+The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2. */
+//How far 0xF055/0xF065 move I
+#define LOAD_STORE_STEP ((QUIRKS & QUIRK_I_UNCHANGED) ? 0 : (QUIRKS & QUIRK_I_PLUS_X) ? c8->X : c8->X+1)
+CREATE_QUIRK_INSTRUCTION(0xF055, {
+    unsigned i;
+    for(i=0; i <= c8->X; i++)
+    {
+        c8->MEMORY[(c8->I_REGISTER + i) & ADDRESS_MASK] = c8->V[i];
+    }
+    if(c8->block_cache) InvalidateCode(c8->block_cache, c8->I_REGISTER, c8->X+1);
+    c8->I_REGISTER += LOAD_STORE_STEP;                                                      
+                                                                                    p("Stores V0 to VX in memory\n");
+})//Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.[d]
+CREATE_QUIRK_INSTRUCTION(0xF065, {
+       unsigned i;
+    for(i=0; i <= c8->X; i++)
+    {
+        c8->V[i] = c8->MEMORY[(c8->I_REGISTER + i) & ADDRESS_MASK];
+    }
+    c8->I_REGISTER += LOAD_STORE_STEP;                                                      
+                                                                                    p("Fills V0 to VX from memory\n");
+})//Fills V0 to VX (including VX) with values from memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
+
+
+//Fill the instruction set of every profile, the entries must stay in the same order in all of them
+#define INSTRUCTION_TABLE(profile) {\
+    BIND_INSTRUCTION(0x00E0, 1),\
+    BIND_INSTRUCTION(0x00EE, 1),\
+    BIND_INSTRUCTION(0x00C0, 1),\
+    BIND_INSTRUCTION(0x00FB, 1),\
+    BIND_INSTRUCTION(0x00FC, 1),\
+    BIND_INSTRUCTION(0x00FE, 1),\
+    BIND_INSTRUCTION(0x00FF, 1),\
+    BIND_INSTRUCTION(0x1000, 0),\
+    BIND_INSTRUCTION(0x2000, 0),\
+    BIND_INSTRUCTION(0x3000, 0),\
+    BIND_INSTRUCTION(0x4000, 0),\
+    BIND_INSTRUCTION(0x5000, 0),\
+    BIND_INSTRUCTION(0x6000, 0),\
+    BIND_INSTRUCTION(0x7000, 0),\
+    BIND_INSTRUCTION(0x8000, 1),\
+    BIND_QUIRK_INSTRUCTION(0x8001, 1, profile),\
+    BIND_QUIRK_INSTRUCTION(0x8002, 1, profile),\
+    BIND_QUIRK_INSTRUCTION(0x8003, 1, profile),\
+    BIND_INSTRUCTION(0x8004, 1),\
+    BIND_INSTRUCTION(0x8005, 1),\
+    BIND_QUIRK_INSTRUCTION(0x8006, 1, profile),\
+    BIND_INSTRUCTION(0x8007, 1),\
+    BIND_QUIRK_INSTRUCTION(0x800E, 1, profile),\
+    BIND_INSTRUCTION(0x9000, 0),\
+    BIND_INSTRUCTION(0xA000, 0),\
+    BIND_QUIRK_INSTRUCTION(0xB000, 0, profile),\
+    BIND_INSTRUCTION(0xC000, 0),\
+    BIND_QUIRK_INSTRUCTION(0xD000, 0, profile),\
+    BIND_INSTRUCTION(0xE09E, 1),\
+    BIND_INSTRUCTION(0xE0A1, 1),\
+    BIND_INSTRUCTION(0xF007, 1),\
+    BIND_INSTRUCTION(0xF00A, 1),\
+    BIND_INSTRUCTION(0xF015, 1),\
+    BIND_INSTRUCTION(0xF018, 1),\
+    BIND_INSTRUCTION(0xF01E, 1),\
+    BIND_INSTRUCTION(0xF029, 1),\
+    BIND_INSTRUCTION(0xF030, 1),\
+    BIND_INSTRUCTION(0xF033, 1),\
+    BIND_QUIRK_INSTRUCTION(0xF055, 1, profile),\
+    BIND_QUIRK_INSTRUCTION(0xF065, 1, profile)\
+}
+#define INSTRUCTION_SET_DEFAULT INSTRUCTION_SET
+INSTRUCTION_REF INSTRUCTION_SET_DEFAULT[] = INSTRUCTION_TABLE(DEFAULT);
+INSTRUCTION_REF INSTRUCTION_SET_VIP[] = INSTRUCTION_TABLE(VIP);
+INSTRUCTION_REF INSTRUCTION_SET_CHIP48[] = INSTRUCTION_TABLE(CHIP48);
+INSTRUCTION_REF INSTRUCTION_SET_SCHIP[] = INSTRUCTION_TABLE(SCHIP);
+INSTRUCTION_REF *const INSTRUCTION_SETS[QUIRK_PROFILES] = {INSTRUCTION_SET_DEFAULT, INSTRUCTION_SET_VIP, INSTRUCTION_SET_CHIP48, INSTRUCTION_SET_SCHIP};
+const uint8_t QUIRK_FLAGS[QUIRK_PROFILES] = {QUIRKS_DEFAULT_FLAGS, QUIRKS_VIP_FLAGS, QUIRKS_CHIP48_FLAGS, QUIRKS_SCHIP_FLAGS};
+
+
+const unsigned INSTRUCTIONS_COUNT = sizeof(INSTRUCTION_SET) / sizeof(INSTRUCTION_SET[0]);
+
+//Decode table: Execute() decodes in constant time instead of scanning the whole instruction set
+uint8_t DECODE_TABLE[0x10000];
+
+//Variants are told apart by the lowest nibble in the 0x8000 group and by the lowest byte everywhere else,
+//0x00C0 carries its scroll distance in the lowest nibble
+uint16_t InstructionMask(const INSTRUCTION_REF *instruction)
+{
+    if(!instruction->hasVariant)
+        return 0xF000;
+    if(instruction->opcode == 0x00C0)
+        return 0xFFF0;
+    return ((instruction->opcode & 0xF000) == 0x8000) ? 0xF00F : 0xF0FF;
+}
+
+void BuildDecodeTable()
+{
+    unsigned op, o;
+    memset(DECODE_TABLE, UNKNOWN_INSTRUCTION, sizeof(DECODE_TABLE));
+    for(o=0; o < INSTRUCTIONS_COUNT; o++)
+    {
+        uint16_t mask = InstructionMask(&INSTRUCTION_SET[o]);
+        for(op=0; op < 0x10000; op++)
+        {
+            if((op & mask) == INSTRUCTION_SET[o].opcode && DECODE_TABLE[op] == UNKNOWN_INSTRUCTION)
+                DECODE_TABLE[op] = (uint8_t)o;
+        }
+    }
+}
+
+//Execute() against a given table, the run loops pass a constant one so the handler addresses are known at compile time
+static inline bool ExecuteWith(CHIP8 *c8, const INSTRUCTION_REF *instruction_set)
+{
+//Opcodes are 2 byte long and stored in big-endian
+//Read 2 byte instruction from memory
+c8->OPCODE = c8->MEMORY[c8->PC & ADDRESS_MASK] << 8 | c8->MEMORY[(c8->PC+1) & ADDRESS_MASK];
+
+//
+c8->X = (c8->OPCODE >> 8) & 0x000F;//A 4-bit value, the lower 4 bits of the high byte of the instruction
+c8->Y = (c8->OPCODE >> 4) & 0x000F;//A 4-bit value, the upper 4 bits of the low byte of the instruction
+c8->NNN = c8->OPCODE & 0x0FFF;//A 12-bit value, the lowest 12 bits of the instruction
+c8->KK = c8->OPCODE & 0x0FF;//lowest 8 bits
+c8->N = c8->OPCODE & 0x0F;//lowest 4 bits
+
+//Move to next instruction
+c8->PC += 2;
+
+uint8_t o = DECODE_TABLE[c8->OPCODE];
+if(o == UNKNOWN_INSTRUCTION){
+    printf("Unknown instruction for opcode 0x%04x\n", c8->OPCODE);
+    return false;
+}
+p("PC:%i  OPCODE 0x%04x\n",c8->PC-2, c8->OPCODE);
+PROFILE_INSTRUCTION(c8, c8->PC - 2, o);
+instruction_set[o].func_ptr(c8);//run instruction
+
+return true;
+};
+
+bool Execute(CHIP8 *c8)
+{
+    return ExecuteWith(c8, INSTRUCTION_SETS[c8->quirks]);
+}
+
+//One interpreter loop per profile, returns the instructions retired
+#define CREATE_RUN_LOOP(profile) static uint32_t RunInstructions_##profile(CHIP8 *c8, uint32_t budget, bool *ok)\
+{\
+    uint32_t i;\
+    for(i=0; i < budget && !c8->WAIT_KEY; i++)\
+    {\
+        uint16_t pc = c8->PC;\
+        if(!ExecuteWith(c8, INSTRUCTION_SET_##profile))\
+        {\
+            *ok = false;\
+            break;\
+        }\
+        if(MAY_CLOSE_IDLE_LOOP(pc, c8->PC))\
+            i += SkipIdleLoop(c8, budget - i - 1);\
+    }\
+    return i;\
+}
+CREATE_RUN_LOOP(DEFAULT)
+CREATE_RUN_LOOP(VIP)
+CREATE_RUN_LOOP(CHIP48)
+CREATE_RUN_LOOP(SCHIP)
+static uint32_t (*const RUN_LOOPS[QUIRK_PROFILES])(CHIP8*, uint32_t, bool*) = {
+    RunInstructions_DEFAULT, RunInstructions_VIP, RunInstructions_CHIP48, RunInstructions_SCHIP};
+
+uint32_t FrameInstructionBudget(uint32_t ips, uint64_t frame)
+{
+    //Derive the count from the running total so fractional rates (e.g. 500/60) never drift
+    return (uint32_t)(((frame + 1) * ips) / TIMER_HZ - (frame * ips) / TIMER_HZ);
+}
+
+bool RunFrame(CHIP8 *c8, uint32_t budget, uint32_t *executed)
+{
+    PROFILE_BEGIN(start);
+    uint32_t i = 0;
+    bool ok = true;
+    //Blocks already hold the handlers of the machine's profile
+    if(c8->block_cache)
+        ok = RunBlocks(c8, budget, &i);
+    else
+        i = RUN_LOOPS[c8->quirks](c8, budget, &ok);
+    PROFILE_END(c8->profile, PROFILE_EXECUTE, start);
+    if(executed)
+        *executed = i;
+    return ok;
+}
+
+#define FETCH(c8, address) ((c8)->MEMORY[(address) & ADDRESS_MASK] << 8 | (c8)->MEMORY[((address) + 1) & ADDRESS_MASK])
+
+uint32_t IdleLoopLength(const CHIP8 *c8)
+{
+    uint16_t head = c8->PC;
+    if(head > ADDRESS_MASK)
+        return 0;//the jump back would land on the wrapped address
+    uint16_t back = 0x1000 | (head & ADDRESS_MASK);//jump to the head of the loop
+    uint16_t first = FETCH(c8, head);
+    if(first == back)
+        return 1;
+    uint8_t x = (first >> 8) & 0xF;
+    uint8_t key = c8->KEY[c8->V[x] & 0xF];
+    //The skip has to fail, the loop is about to exit otherwise
+    if((first & 0xF0FF) == 0xE09E && FETCH(c8, head + 2) == back && !key)
+        return 2;
+    if((first & 0xF0FF) == 0xE0A1 && FETCH(c8, head + 2) == back && key)
+        return 2;
+    if((first & 0xF0FF) == 0xF007)
+    {
+        uint16_t skip = FETCH(c8, head + 2);
+        if((skip & 0xFF00) == (0x3000 | x << 8) && FETCH(c8, head + 4) == back && c8->delay_timer != (skip & 0xFF))
+            return 3;
+    }
+    return 0;
+}
+
+uint32_t SkipIdleLoop(CHIP8 *c8, uint32_t remaining)
+{
+    uint32_t length = IdleLoopLength(c8);
+    if(length == 0 || remaining < length)
+        return 0;
+    uint32_t skipped = remaining - remaining % length;
+    //The only thing an iteration leaves behind is the timer read of the delay loop
+    if(length == 3)
+        c8->V[(FETCH(c8, c8->PC) >> 8) & 0xF] = c8->delay_timer;
+    c8->idle_instructions += skipped;
+    PROFILE_LOOP(c8, c8->PC, length, skipped / length);
+    return skipped;
+}
+
+void TickTimers(CHIP8 *c8)
+{
+    //Subtract 1 every tick (60hz)
+    if(c8->delay_timer > 0)
+        c8->delay_timer--;
+
+    if(c8->sound_timer > 0)
+        c8->sound_timer--;
+    PROFILE_FRAME(c8);
+}
+
+void InitChip8(CHIP8 *c8)
+{
+    //Set from counter to 0x200
+    c8->PC          = 0x200;
+    c8->OPCODE      = 0;
+    c8->I_REGISTER  = 0;
+    c8->SP          = 0;
+    c8->draw_flag   = true;
+    c8->dirty_rows  = ALL_ROWS_DIRTY;
+    c8->WAIT_KEY    = false;
+    c8->hires       = false;
+    c8->idle_instructions = 0;
+    c8->quirks      = QUIRKS_DEFAULT;
+    c8->delay_timer = 0;
+    c8->sound_timer = 0;
+    c8->operands    = 0;
+    c8->block_cache = NULL;
+    SeedChip8(c8, DEFAULT_SEED);
+#ifdef CHIP8_PROFILE
+    c8->profile     = NULL;
+#endif
+    //Reset memory
+    memset(c8->MEMORY,      0, MEMORY_SIZE);
+    memset(c8->V,           0, V_REGISTER_SIZE);
+    memset(c8->STACK,       0, STACK_SIZE);
+    memset(c8->DISPLAY,     0, DISPLAY_SIZE);
+    memset(c8->KEY,         0, KEY_SIZE);
+    //Copy font set into memory
+    memcpy(c8->MEMORY, chip8_fontset, FONTSET_BYTES_PER_CHAR * 16);
+    memcpy(&c8->MEMORY[BIG_FONTSET_ADDRESS], chip8_big_fontset, BIG_FONTSET_BYTES_PER_CHAR * 16);
+}
+
+void SeedChip8(CHIP8 *c8, uint64_t seed)
+{
+    //splitmix64 spreads any seed, 0 included, over the whole state
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    c8->random_state = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+void SetQuirkProfile(CHIP8 *c8, QUIRK_PROFILE profile)
+{
+    c8->quirks = (uint8_t)profile;
+    if(c8->block_cache)
+        ResetBlockCache(c8->block_cache);
+}
@@ -0,0 +1,169 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+//DEBUG PRINT
+#ifdef _DEBUG
+#define p(...) printf(__VA_ARGS__);
+#else
+#define p(...)
+#endif
+
+#define true 1
+#define false 0
+#define bool int
+
+//Super Chip-48, an interpreter for the HP48 calculator, added a 128x64-pixel mode. This mode is now supported by most of the interpreters on other platforms.
+//The display is always sized for it, the 64x32 mode only uses the first word of the first 32 rows
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+#define DISPLAY_ROW_WORDS (DISPLAY_WIDTH / 64)
+#define LORES_WIDTH 64
+#define LORES_HEIGHT 32
+#define MEMORY_SIZE sizeof(uint8_t) * 0x1000
+#define ADDRESS_MASK 0xFFF//addresses wrap around the 4K address space
+#define V_REGISTER_SIZE sizeof(uint8_t) * 0x10
+#define STACK_SIZE sizeof(uint16_t) * 0x10
+#define KEY_SIZE sizeof(uint8_t) * 0x10
+#define DISPLAY_SIZE sizeof(uint64_t) * DISPLAY_ROW_WORDS * DISPLAY_HEIGHT
+#define MAX_GAME_SIZE (0x1000 - 0x200)
+#define ALL_ROWS_DIRTY (DISPLAY_HEIGHT >= 64 ? ~0ULL : (1ULL << DISPLAY_HEIGHT) - 1)
+//Size of the current mode
+#define MODE_WIDTH(c8) ((c8)->hires ? DISPLAY_WIDTH : LORES_WIDTH)
+#define MODE_HEIGHT(c8) ((c8)->hires ? DISPLAY_HEIGHT : LORES_HEIGHT)
+//Read one pixel of the packed display
+#define DISPLAY_PIXEL(c8, x, y) (((c8)->DISPLAY[(y)][(x) >> 6] >> (63 - ((x) & 63))) & 0x1)
+
+#define OPERAND_FIELDS struct {\
+    uint16_t OPCODE;\
+    uint8_t X;/*A 4-bit value, the lower 4 bits of the high byte of the instruction*/\
+    uint8_t Y;/*A 4-bit value, the upper 4 bits of the low byte of the instruction*/\
+    uint16_t NNN;/*A 12-bit value, the lowest 12 bits of the instruction*/\
+    uint8_t  KK;/*lowest 8 bits*/\
+    uint8_t  N;/*lowest 4 bits*/\
+}
+
+typedef union {
+    OPERAND_FIELDS;
+    uint64_t packed;
+} OPERANDS;
+
+//Behaviours the original interpreters disagree on. Each quirk profile is a fixed combination of them, and every
+//affected handler is compiled once per profile with the combination as a constant, so no handler tests a quirk at run time
+#define QUIRK_SHIFT_VY    0x01//0x8006/0x800E shift Vy into Vx instead of shifting Vx in place
+#define QUIRK_VF_RESET    0x02//0x8001/0x8002/0x8003 clear VF
+#define QUIRK_I_PLUS_X    0x04//0xF055/0xF065 advance I by X instead of X+1
+#define QUIRK_I_UNCHANGED 0x08//0xF055/0xF065 leave I alone
+#define QUIRK_JUMP_VX     0x10//0xB000 jumps to xnn + Vx instead of nnn + V0
+#define QUIRK_CLIP        0x20//0xD000 clips sprites at the screen edges instead of wrapping them around
+
+//QUIRKS_DEFAULT is this interpreter's own behaviour, the others follow the machines they are named after
+typedef enum {QUIRKS_DEFAULT, QUIRKS_VIP, QUIRKS_CHIP48, QUIRKS_SCHIP, QUIRK_PROFILES} QUIRK_PROFILE;
+#define QUIRKS_DEFAULT_FLAGS 0
+#define QUIRKS_VIP_FLAGS     (QUIRK_SHIFT_VY | QUIRK_VF_RESET | QUIRK_CLIP)//COSMAC VIP
+#define QUIRKS_CHIP48_FLAGS  (QUIRK_I_PLUS_X | QUIRK_JUMP_VX | QUIRK_CLIP)//CHIP-48 on the HP48
+#define QUIRKS_SCHIP_FLAGS   (QUIRK_I_UNCHANGED | QUIRK_JUMP_VX | QUIRK_CLIP)//SUPER-CHIP 1.1
+
+//CHIP8 INTERNAL MEMORY RAPPRESENTATION
+//All the state of one machine, every instruction handler receives the machine it runs on
+typedef struct CHIP8 {
+    uint8_t MEMORY[0x1000];//Main chip8 memory
+    uint8_t V[0x10];//16 general purpose 8-bit registers, usually referred to as Vx, where x is a hexadecimal digit (0 through F)
+    uint16_t I_REGISTER;//This is a 16-bit register called I. This register is generally used to store memory addresses, so only the lowest (rightmost) 12 bits are usually used.
+    uint16_t PC;//The program counter is used to store the currently executing address
+    uint16_t STACK[0x10];//The stack is an array of 16 16-bit values, used to store the address that the interpreter shoud return to when finished with a subroutine. Chip-8 allows for up to 16 levels of nested subroutines.
+    uint8_t SP;//The stack pointer it is used to point to the topmost level of the stack
+    uint8_t KEY[0x10];
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint64_t DISPLAY[DISPLAY_HEIGHT][DISPLAY_ROW_WORDS];//Rows of 64-bit words stored back to back, the most significant bit is the leftmost pixel
+    bool hires;//128x64 mode, switched by 0x00FF and 0x00FE
+    uint64_t random_state;//xorshift64* state behind 0xC000, never 0
+    //Decoded fields of the current instruction, `operands` aliases all of them so a predecoded instruction is loaded with a single store
+    union {
+        OPERAND_FIELDS;
+        uint64_t operands;
+    };
+    //Some flags
+    bool draw_flag;//update screen when is true
+    uint64_t dirty_rows;//bit y is set when display row y changed since the front end last cleared it
+    bool WAIT_KEY;//stall emulation and wait for a key press when is true
+    uint64_t idle_instructions;//instructions of idle loops skipped instead of run, see SkipIdleLoop()
+    uint8_t quirks;//QUIRK_PROFILE picking the handlers and the run loop, change it with SetQuirkProfile()
+    struct BLOCK_CACHE *block_cache;//predecoded blocks for this machine, NULL runs the plain interpreter (see blockcache.h)
+#ifdef CHIP8_PROFILE
+    struct PROFILE *profile;//counters for this machine or NULL (see profiler.h)
+#endif
+} CHIP8;
+
+#define TIMER_HZ 60//delay and sound timers count down at 60Hz
+#define DEFAULT_IPS 700//instructions per second when nothing else is requested
+#define DEFAULT_SEED 0x43484950//random seed of a freshly initialized machine
+
+#define FONTSET_ADDRESS 0x00
+#define FONTSET_BYTES_PER_CHAR 5
+#define BIG_FONTSET_ADDRESS 0x50//8x10 digits of 0xF030, right after the small ones
+#define BIG_FONTSET_BYTES_PER_CHAR 10
+
+//Split an opcode into the fields the instruction handlers read
+static inline OPERANDS DecodeOperands(uint16_t opcode)
+{
+    OPERANDS o;
+    o.OPCODE = opcode;
+    o.X = (opcode >> 8) & 0x000F;
+    o.Y = (opcode >> 4) & 0x000F;
+    o.NNN = opcode & 0x0FFF;
+    o.KK = opcode & 0x0FF;
+    o.N = opcode & 0x0F;
+    return o;
+}
+
+typedef void (*INSTRUCTION_FUNC)(CHIP8 *c8);
+typedef struct {uint32_t opcode; bool hasVariant; INSTRUCTION_FUNC func_ptr;}INSTRUCTION_REF;
+//Handlers of QUIRKS_DEFAULT. The opcodes, and so the indices DECODE_TABLE gives, are the same in every profile
+extern INSTRUCTION_REF INSTRUCTION_SET[];
+//INSTRUCTION_SET specialized for each QUIRK_PROFILE
+extern INSTRUCTION_REF *const INSTRUCTION_SETS[QUIRK_PROFILES];
+extern const uint8_t QUIRK_FLAGS[QUIRK_PROFILES];
+extern const unsigned INSTRUCTIONS_COUNT;
+//Every 16-bit opcode maps to its index in INSTRUCTION_SET, or UNKNOWN_INSTRUCTION
+#define UNKNOWN_INSTRUCTION 0xFF
+extern uint8_t DECODE_TABLE[0x10000];
+
+//Precompute the opcode -> instruction lookup, call once at startup before running any machine
+void BuildDecodeTable();
+//Reset the machine and copy the font set, the random generator starts from DEFAULT_SEED and the quirks from QUIRKS_DEFAULT
+void InitChip8(CHIP8 *c8);
+//Restart the random generator of 0xC000, equal seeds give equal runs
+void SeedChip8(CHIP8 *c8, uint64_t seed);
+//Switch the machine to the handlers of another profile, dropping any block built for the old one
+void SetQuirkProfile(CHIP8 *c8, QUIRK_PROFILE profile);
+//Load a rom at 0x200, returns false if the file can't be opened
+bool LoadGame(CHIP8 *c8, const char *filename);
+//Copy a rom already in memory at 0x200
+void LoadGameFromBuffer(CHIP8 *c8, const uint8_t *rom, size_t size);
+//Run a single instruction, returns false on an unknown opcode
+bool Execute(CHIP8 *c8);
+//Number of instructions frame number `frame` has to run to keep an average of `ips` instructions per second
+uint32_t FrameInstructionBudget(uint32_t ips, uint64_t frame);
+//Run up to `budget` instructions, stopping early while waiting for a key. Returns false on an unknown opcode
+bool RunFrame(CHIP8 *c8, uint32_t budget, uint32_t *executed);
+//Length in instructions of the idle loop starting at PC, or 0. Idle loops only read state that can't change before
+//the frame ends, the delay timer or the keypad, so every iteration until then leaves the machine as it found it:
+//  1NNN jumping to itself             forever
+//  Ex9E or ExA1, 1NNN back            until the key changes
+//  Fx07, 3xkk, 1NNN back              until the delay timer reaches kk
+uint32_t IdleLoopLength(const CHIP8 *c8);
+//Account for as many whole iterations of the idle loop at PC as fit in `remaining` instructions without running
+//them, returns the instructions skipped. Called on short backward jumps by RunFrame() and RunBlocks()
+uint32_t SkipIdleLoop(CHIP8 *c8, uint32_t remaining);
+//Cheap filter for the callers: the jump from `from` to `to` goes back at most the 4 bytes an idle loop spans
+#define MAY_CLOSE_IDLE_LOOP(from, to) ((uint16_t)((from) - (to)) <= 4)
+//Count delay and sound timers down, must be called at TIMER_HZ
+void TickTimers(CHIP8 *c8);
+
+#endif
@@ -1,2 +1,2 @@
-clang -m64 main.c -I"D:\Libraries\include" -L"D:\Libraries\SDL_lib\x64" -lSDL2main -lSDL2 -Xlinker /subsystem:windows -o ".\x64\build.exe"
+clang -m64 main.c chip8.c blockcache.c jit.c audio.c savestate.c profiler.c replay.c quirks.c triplebuffer.c aot.c lockstep.c -I"D:\Libraries\include" -L"D:\Libraries\SDL_lib\x64" -lSDL2main -lSDL2 -Xlinker /subsystem:windows -o ".\x64\build.exe"
 PAUSE
\ No newline at end of file
@@ -1,2 +1,2 @@
-clang -m32 main.c -I"D:\Libraries\include" -L"D:\Libraries\SDL_lib\x86" -lSDL2main -lSDL2 -Xlinker /subsystem:windows -o ".\x86\build.exe"
+clang -m32 main.c chip8.c blockcache.c jit.c audio.c savestate.c profiler.c replay.c quirks.c triplebuffer.c aot.c lockstep.c -I"D:\Libraries\include" -L"D:\Libraries\SDL_lib\x86" -lSDL2main -lSDL2 -Xlinker /subsystem:windows -o ".\x86\build.exe"
 PAUSE
\ No newline at end of file
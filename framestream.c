@@ -0,0 +1,267 @@
+//popen() and fdopen() are not part of strict ISO C
+#define _DEFAULT_SOURCE
+
+#include "framestream.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+typedef CRITICAL_SECTION MUTEX;
+typedef CONDITION_VARIABLE CONDITION;
+#define MUTEX_INIT(m)        InitializeCriticalSection(m)
+#define MUTEX_DESTROY(m)     DeleteCriticalSection(m)
+#define MUTEX_LOCK(m)        EnterCriticalSection(m)
+#define MUTEX_UNLOCK(m)      LeaveCriticalSection(m)
+#define CONDITION_INIT(c)    InitializeConditionVariable(c)
+#define CONDITION_DESTROY(c)
+#define CONDITION_WAIT(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define CONDITION_SIGNAL(c)  WakeConditionVariable(c)
+#define popen _popen
+#define pclose _pclose
+#define fdopen _fdopen
+typedef HANDLE THREAD;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t MUTEX;
+typedef pthread_cond_t CONDITION;
+#define MUTEX_INIT(m)        pthread_mutex_init(m, NULL)
+#define MUTEX_DESTROY(m)     pthread_mutex_destroy(m)
+#define MUTEX_LOCK(m)        pthread_mutex_lock(m)
+#define MUTEX_UNLOCK(m)      pthread_mutex_unlock(m)
+#define CONDITION_INIT(c)    pthread_cond_init(c, NULL)
+#define CONDITION_DESTROY(c) pthread_cond_destroy(c)
+#define CONDITION_WAIT(c, m) pthread_cond_wait(c, m)
+#define CONDITION_SIGNAL(c)  pthread_cond_signal(c)
+typedef pthread_t THREAD;
+#endif
+
+#define Y4M_FRAME_BYTES (STREAM_WIDTH * STREAM_HEIGHT)
+
+struct FRAME_STREAM {
+    FILE *file;
+    bool piped;//opened with popen()
+    STREAM_FORMAT format;
+    bool unique;
+    THREAD writer;
+    MUTEX lock;
+    CONDITION queued;//the writer has frames to write, or has to stop
+    CONDITION freed;//the writer made room in the ring
+    //Ring, the emulation fills slot `head % STREAM_RING_FRAMES` and the writer drains from `tail`. Counters only
+    //change under `lock`, slots are copied outside it by whichever side owns them
+    FRAME ring[STREAM_RING_FRAMES];
+    uint64_t head;
+    uint64_t tail;
+    bool closing;
+    //Emulation thread
+    FRAME last;//last frame queued, for `unique`
+    bool has_last;
+    STREAM_STATS stats;
+    //Writer thread
+    uint8_t out[8 + Y4M_FRAME_BYTES + 64];//encoded frame
+    bool failed;
+};
+
+//Pixels of a 64x32 row byte doubled horizontally
+static uint16_t DOUBLE_BITS[256];
+//Y4M luma of the 8 pixels of a byte
+static uint8_t LUMA[256][8];
+
+//Row `y` of the stream, packed 1 bit per pixel
+static void PackRow(const FRAME *frame, unsigned y, uint8_t *out)
+{
+    unsigned x;
+    if(frame->hires)
+    {
+        for(x=0; x < STREAM_WIDTH / 8; x++)
+            out[x] = (uint8_t)(frame->display[y][x / 8] >> (56 - (x % 8) * 8));
+        return;
+    }
+    uint64_t row = frame->display[y / 2][0];
+    for(x=0; x < LORES_WIDTH / 8; x++)
+    {
+        uint16_t wide = DOUBLE_BITS[(uint8_t)(row >> (56 - x * 8))];
+        out[x * 2] = (uint8_t)(wide >> 8);
+        out[x * 2 + 1] = (uint8_t)wide;
+    }
+}
+
+//Encode `frame` into `out`, returns its length
+static size_t EncodeFrame(const FRAME_STREAM *stream, const FRAME *frame, uint8_t *out)
+{
+    size_t n = 0;
+    unsigned x, y, b;
+    if(stream->format == STREAM_Y4M)
+    {
+        uint8_t packed[STREAM_WIDTH / 8];
+        if(stream->unique)
+            n += (size_t)sprintf((char*)out, "FRAME Xframe=%llu\n", (unsigned long long)frame->frame);
+        else
+            n += (size_t)sprintf((char*)out, "FRAME\n");
+        for(y=0; y < STREAM_HEIGHT; y++)
+        {
+            PackRow(frame, y, packed);
+            for(x=0; x < STREAM_WIDTH / 8; x++, n += 8)
+                memcpy(&out[n], LUMA[packed[x]], 8);
+        }
+        return n;
+    }
+
+    if(stream->unique)
+        for(b=0; b < 8; b++)
+            out[n++] = (uint8_t)(frame->frame >> (b * 8));
+    for(y=0; y < STREAM_HEIGHT; y++, n += STREAM_WIDTH / 8)
+        PackRow(frame, y, &out[n]);
+    return n;
+}
+
+static void WriterLoop(FRAME_STREAM *stream)
+{
+    MUTEX_LOCK(&stream->lock);
+    for(;;)
+    {
+        while(stream->tail == stream->head && !stream->closing)
+            CONDITION_WAIT(&stream->queued, &stream->lock);
+        if(stream->tail == stream->head)
+            break;
+        const FRAME *frame = &stream->ring[stream->tail % STREAM_RING_FRAMES];
+        MUTEX_UNLOCK(&stream->lock);
+
+        size_t n = EncodeFrame(stream, frame, stream->out);
+        if(!stream->failed && fwrite(stream->out, 1, n, stream->file) != n)
+            stream->failed = true;
+
+        MUTEX_LOCK(&stream->lock);
+        stream->tail++;
+        CONDITION_SIGNAL(&stream->freed);
+    }
+    MUTEX_UNLOCK(&stream->lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WriterEntry(LPVOID arg) { WriterLoop((FRAME_STREAM*)arg); return 0; }
+#else
+static void *WriterEntry(void *arg) { WriterLoop((FRAME_STREAM*)arg); return NULL; }
+#endif
+
+FRAME_STREAM *OpenFrameStream(const char *target, STREAM_FORMAT format, bool unique)
+{
+    FRAME_STREAM *stream = (FRAME_STREAM*)calloc(1, sizeof(FRAME_STREAM));
+    unsigned i, b;
+    if(stream == NULL)
+        return NULL;
+    if(target[0] == '|')
+    {
+        stream->file = popen(target + 1, "w");
+        stream->piped = true;
+    }
+    else if(strncmp(target, "fd:", 3) == 0)
+        stream->file = fdopen((int)strtol(target + 3, NULL, 10), "wb");
+    else
+        stream->file = fopen(target, "wb");
+    if(stream->file == NULL)
+    {
+        free(stream);
+        return NULL;
+    }
+    //Large writes, the writer hands over a frame at a time
+    setvbuf(stream->file, NULL, _IOFBF, 1 << 20);
+    stream->format = format;
+    stream->unique = unique;
+    if(format == STREAM_Y4M)
+        fprintf(stream->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 Cmono\n", STREAM_WIDTH, STREAM_HEIGHT, TIMER_HZ);
+
+    for(i=0; i < 256; i++)
+    {
+        DOUBLE_BITS[i] = 0;
+        for(b=0; b < 8; b++)
+        {
+            if(i & (0x80 >> b))
+                DOUBLE_BITS[i] |= 0xC000 >> (b * 2);
+            LUMA[i][b] = (i & (0x80 >> b)) ? 255 : 0;
+        }
+    }
+
+    MUTEX_INIT(&stream->lock);
+    CONDITION_INIT(&stream->queued);
+    CONDITION_INIT(&stream->freed);
+#ifdef _WIN32
+    stream->writer = CreateThread(NULL, 0, WriterEntry, stream, 0, NULL);
+    bool started = stream->writer != NULL;
+#else
+    bool started = pthread_create(&stream->writer, NULL, WriterEntry, stream) == 0;
+#endif
+    if(!started)
+    {
+        CONDITION_DESTROY(&stream->queued);
+        CONDITION_DESTROY(&stream->freed);
+        MUTEX_DESTROY(&stream->lock);
+        if(stream->piped)
+            pclose(stream->file);
+        else
+            fclose(stream->file);
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void StreamFrame(FRAME_STREAM *stream, const CHIP8 *c8, uint64_t frame)
+{
+    stream->stats.frames++;
+    if(stream->unique && stream->has_last && stream->last.hires == c8->hires && memcmp(stream->last.display, c8->DISPLAY, DISPLAY_SIZE) == 0)
+    {
+        stream->stats.duplicates++;
+        return;
+    }
+
+    MUTEX_LOCK(&stream->lock);
+    if(stream->head - stream->tail == STREAM_RING_FRAMES)
+    {
+        stream->stats.stalls++;
+        while(stream->head - stream->tail == STREAM_RING_FRAMES)
+            CONDITION_WAIT(&stream->freed, &stream->lock);
+    }
+    FRAME *slot = &stream->ring[stream->head % STREAM_RING_FRAMES];
+    MUTEX_UNLOCK(&stream->lock);
+
+    memcpy(slot->display, c8->DISPLAY, DISPLAY_SIZE);
+    slot->hires = c8->hires;
+    slot->frame = frame;
+    if(stream->unique)
+    {
+        stream->last = *slot;
+        stream->has_last = true;
+    }
+
+    MUTEX_LOCK(&stream->lock);
+    stream->head++;
+    CONDITION_SIGNAL(&stream->queued);
+    MUTEX_UNLOCK(&stream->lock);
+    stream->stats.written++;
+}
+
+void CloseFrameStream(FRAME_STREAM *stream, STREAM_STATS *stats)
+{
+    MUTEX_LOCK(&stream->lock);
+    stream->closing = true;
+    CONDITION_SIGNAL(&stream->queued);
+    MUTEX_UNLOCK(&stream->lock);
+#ifdef _WIN32
+    WaitForSingleObject(stream->writer, INFINITE);
+    CloseHandle(stream->writer);
+#else
+    pthread_join(stream->writer, NULL);
+#endif
+
+    stream->stats.failed = stream->failed;
+    if(fflush(stream->file) != 0)
+        stream->stats.failed = true;
+    if(stream->piped ? pclose(stream->file) != 0 : fclose(stream->file) != 0)
+        stream->stats.failed = true;
+    if(stats)
+        *stats = stream->stats;
+    CONDITION_DESTROY(&stream->queued);
+    CONDITION_DESTROY(&stream->freed);
+    MUTEX_DESTROY(&stream->lock);
+    free(stream);
+}
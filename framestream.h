@@ -0,0 +1,42 @@
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include "chip8.h"
+#include "triplebuffer.h"
+
+//Headless video capture: every frame handed to StreamFrame() is copied into a preallocated ring, and a writer thread
+//encodes and writes it, so a slow disk or pipe never runs on the emulation thread. The emulation only waits when
+//the whole ring is full. Frames are always 128x64, 64x32 frames have every pixel doubled, so the size never changes
+//mid-stream:
+//  STREAM_RAW  1 bit per pixel, rows top to bottom, the most significant bit of each byte leftmost, 1 = lit
+//              (ffmpeg -f rawvideo -pix_fmt monob -s 128x64 -r 60)
+//  STREAM_Y4M  YUV4MPEG2 at 60fps in the mono colour space, 0 or 255 per pixel
+//With `unique` a frame identical to the last one written is dropped, and every frame written carries the emulated
+//frame it was taken after: a little-endian u64 before each raw frame, an `Xframe=` parameter on each Y4M FRAME line.
+
+#define STREAM_RING_FRAMES 256
+#define STREAM_WIDTH DISPLAY_WIDTH
+#define STREAM_HEIGHT DISPLAY_HEIGHT
+
+typedef enum {STREAM_RAW, STREAM_Y4M} STREAM_FORMAT;
+
+typedef struct {
+    uint64_t frames;//frames handed to StreamFrame()
+    uint64_t written;
+    uint64_t duplicates;//frames dropped by `unique`
+    uint64_t stalls;//times the emulation waited on a full ring
+    bool failed;//a write to the target failed
+} STREAM_STATS;
+
+typedef struct FRAME_STREAM FRAME_STREAM;
+
+//`target` is a file name, `fd:N` for an open file descriptor or `|command` to pipe into a command. A reader that
+//goes away raises SIGPIPE, ignore it to have the writes fail instead.
+//Returns NULL if the target can't be opened or the writer thread can't start
+FRAME_STREAM *OpenFrameStream(const char *target, STREAM_FORMAT format, bool unique);
+//Queue the display of `c8` as it is after emulated frame `frame`
+void StreamFrame(FRAME_STREAM *stream, const CHIP8 *c8, uint64_t frame);
+//Write out every queued frame, stop the writer and close the target
+void CloseFrameStream(FRAME_STREAM *stream, STREAM_STATS *stats);
+
+#endif
@@ -0,0 +1,1113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#endif
+
+#include "chip8.h"
+#include "threadpool.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "audio.h"
+#include "savestate.h"
+#include "profiler.h"
+#include "replay.h"
+#include "quirks.h"
+#include "framestream.h"
+#include "lockstep.h"
+
+//Headless batch runner: runs a rom through the interpreter core without SDL and reports throughput
+
+typedef enum {OUTPUT_TEXT, OUTPUT_JSON} OUTPUT_FORMAT;
+typedef enum {ENGINE_INTERPRETER, ENGINE_BLOCKS, ENGINE_JIT, ENGINE_LOCKSTEP} ENGINE;
+
+typedef struct {
+    const char *path;
+    uint8_t data[MAX_GAME_SIZE];
+    size_t size;
+    QUIRK_PROFILE quirks;
+} ROM;
+
+typedef struct {
+    uint64_t cycles;//instruction budget, 0 = no limit
+    uint64_t frames;//frame budget, 0 = no limit
+    uint32_t ips;
+} RUN_LIMITS;
+
+typedef struct {
+    const char *status;
+    uint64_t instructions;
+    uint64_t frames;
+    uint16_t pc;
+    uint64_t display_hash;
+    uint64_t idle_instructions;//part of `instructions` skipped as idle loops
+    uint64_t frame_hash;//rolling HashFrame() after the last frame, only kept with -t or -r
+    uint64_t state_hash;//registers, display and memory of the final machine, what -x -e lockstep compares
+    double execute_time;//seconds spent in RunFrame(), only measured when -w, -v or -t add work to every frame
+} RUN_RESULT;
+
+//Offline beeper: every emulated frame renders exactly its share of samples, so edges land on their frame
+typedef struct {
+    FILE *file;
+    BEEPER beeper;
+    uint64_t samples;
+} WAV_OUTPUT;
+
+//Every job runs one rom with one keypad combination: job = rom * instances + instance,
+//instance i holds down the keys set in the bits of i for the whole run
+typedef struct {
+    const ROM *roms;
+    unsigned instances;
+    RUN_LIMITS limits;
+    ENGINE engine;
+    CHIP8 *machines;//one per worker, reused between jobs
+    BLOCK_CACHE **caches;//one per worker when running ENGINE_BLOCKS or ENGINE_JIT
+    LOCKSTEP **locksteps;//one per worker when running ENGINE_LOCKSTEP
+    WAV_OUTPUT *wav;//audio of the single job, or NULL
+    const uint8_t *start_state;//save state every job starts from instead of power-on, or NULL
+    PROFILE *profiles;//one per worker when profiling, or NULL
+    uint64_t seed;
+    INPUT_REPLAY *replay;//input of the single job, or NULL
+    FILE *trace;//per-frame hashes of the single job, or NULL
+    FRAME_STREAM *video;//display of the single job after every frame, or NULL
+    RUN_RESULT *results;
+} BATCH;
+
+//Monotonic wall clock in seconds
+double WallTime()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+//Print a string as a quoted JSON value
+void PrintJsonString(const char *str)
+{
+    putchar('"');
+    for(; *str; str++)
+    {
+        if(*str == '"' || *str == '\\') putchar('\\');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+bool ReadRom(ROM *rom, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        return false;
+    rom->path = path;
+    rom->size = fread(rom->data, 1, MAX_GAME_SIZE, file);
+    fclose(file);
+    return true;
+}
+
+//44 byte RIFF header for unsigned 8-bit mono
+void WriteWavHeader(FILE *file, unsigned rate, uint64_t samples)
+{
+    uint8_t header[44];
+    uint32_t data = samples > 0xFFFFFFD3u ? 0xFFFFFFD3u : (uint32_t)samples;
+    uint32_t fields[][2] = {
+        {4, 36 + data},//riff chunk size
+        {16, 16}, {20, 1 | 1 << 16},//fmt chunk size, pcm and 1 channel
+        {24, rate}, {28, rate},//sample rate and byte rate
+        {32, 1 | 8 << 16},//block align and bits per sample
+        {40, data}
+    };
+    unsigned f, b;
+    memcpy(header, "RIFF----WAVEfmt ", 16);
+    memcpy(header + 36, "data", 4);
+    for(f=0; f < sizeof(fields) / sizeof(fields[0]); f++)
+    for(b=0; b < 4; b++)
+        header[fields[f][0] + b] = (uint8_t)(fields[f][1] >> (b * 8));
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+}
+
+//Render the samples up to the end of `frame`
+void RenderWavFrame(WAV_OUTPUT *wav, uint64_t frame)
+{
+    uint8_t buffer[AUDIO_BUFFER_SAMPLES];
+    uint64_t end = (frame + 1) * wav->beeper.rate / TIMER_HZ;
+    while(wav->samples < end)
+    {
+        unsigned count = end - wav->samples < AUDIO_BUFFER_SAMPLES ? (unsigned)(end - wav->samples) : AUDIO_BUFFER_SAMPLES;
+        RenderBeeper(&wav->beeper, buffer, count);
+        fwrite(buffer, 1, count, wav->file);
+        wav->samples += count;
+    }
+}
+
+//HashFrame() of the final machine folded with its memory
+uint64_t HashState(const CHIP8 *c8)
+{
+    uint64_t hash = HashFrame(c8, INITIAL_FRAME_HASH);
+    unsigned a;
+    for(a=0; a < MEMORY_SIZE; a++)
+    {
+        hash ^= c8->MEMORY[a];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+//True when the jobs write something after every frame, so their wall time is no longer the time spent running them
+bool HasFrameOutput(const BATCH *batch)
+{
+    return batch->wav || batch->video || batch->trace;
+}
+
+//Emulated time: every frame retires its share of the ips budget, then the timers tick
+void RunMachine(CHIP8 *c8, const BATCH *batch, RUN_RESULT *result)
+{
+    const RUN_LIMITS *limits = &batch->limits;
+    WAV_OUTPUT *wav = batch->wav;
+    bool timed = HasFrameOutput(batch);
+    uint64_t executed = 0;
+    uint64_t frame = 0;
+    uint64_t frame_hash = INITIAL_FRAME_HASH;
+    result->status = "ok";
+    result->execute_time = 0.0;
+    while((limits->frames == 0 || frame < limits->frames) && (limits->cycles == 0 || executed < limits->cycles))
+    {
+        if(batch->replay && !ReplayFrame(batch->replay, c8))
+            break;
+        uint32_t budget = FrameInstructionBudget(limits->ips, frame);
+        uint32_t ran = 0;
+        if(limits->cycles && limits->cycles - executed < budget)
+            budget = (uint32_t)(limits->cycles - executed);
+        double execute_start = timed ? WallTime() : 0.0;
+        bool ok = RunFrame(c8, budget, &ran);
+        if(timed)
+            result->execute_time += WallTime() - execute_start;
+        executed += ran;
+        if(!ok) { result->status = "unknown_opcode"; break; }
+        //There is no keyboard to resolve 0xF00A, so the run ends here unless the replay resolves it later
+        if(c8->WAIT_KEY && !batch->replay) { result->status = "waiting_for_key"; break; }
+        if(wav)
+        {
+            BeeperTimer(&wav->beeper, c8->sound_timer, frame);
+            RenderWavFrame(wav, frame);
+        }
+        TickTimers(c8);
+        if(batch->video)
+            StreamFrame(batch->video, c8, frame);
+        if(batch->trace || batch->replay)
+        {
+            frame_hash = HashFrame(c8, frame_hash);
+            if(batch->trace)
+                fprintf(batch->trace, "%llu %016llx\n", (unsigned long long)frame, (unsigned long long)frame_hash);
+        }
+        frame++;
+    }
+    if(c8->WAIT_KEY && batch->replay)
+        result->status = "waiting_for_key";
+    result->instructions = executed;
+    result->frames = frame;
+    result->pc = c8->PC;
+    result->display_hash = HashDisplay(c8);
+    result->frame_hash = frame_hash;
+    result->state_hash = HashState(c8);
+    result->idle_instructions = c8->idle_instructions;
+}
+
+//Power on the machine of `job` on `worker`, ready to run
+void StartJob(const BATCH *batch, CHIP8 *c8, unsigned worker, size_t job)
+{
+    const ROM *rom = &batch->roms[job / batch->instances];
+    unsigned instance = (unsigned)(job % batch->instances);
+    unsigned k;
+
+    InitChip8(c8);
+    SeedChip8(c8, batch->seed);
+    SetQuirkProfile(c8, rom->quirks);
+    LoadGameFromBuffer(c8, rom->data, rom->size);
+    if(batch->engine == ENGINE_BLOCKS || batch->engine == ENGINE_JIT)
+        AttachBlockCache(c8, batch->caches[worker]);
+    if(batch->start_state)
+        LoadState(c8, batch->start_state, SAVESTATE_SIZE);
+#ifdef CHIP8_PROFILE
+    c8->profile = batch->profiles ? &batch->profiles[worker] : NULL;
+#endif
+    for(k=0; k < 0x10; k++)
+        c8->KEY[k] = (instance >> k) & 0x1;
+}
+
+void RunBatchJob(void *userdata, unsigned worker, size_t job)
+{
+    BATCH *batch = (BATCH*)userdata;
+    CHIP8 *c8 = &batch->machines[worker];
+    StartJob(batch, c8, worker, job);
+    RunMachine(c8, batch, &batch->results[job]);
+}
+
+//Run one job on the batch engine and on the plain interpreter in lockstep, comparing the whole machine after
+//every block (a native block is the smallest step the jit can be observed at). Returns false on the first mismatch
+bool CrossCheckJob(BATCH *batch, size_t job)
+{
+    static CHIP8 engine, reference;
+    const ROM *rom = &batch->roms[job / batch->instances];
+    unsigned instance = (unsigned)(job % batch->instances);
+    const RUN_LIMITS *limits = &batch->limits;
+    RUN_RESULT *result = &batch->results[job];
+    uint64_t executed = 0;
+    uint64_t frame = 0;
+    unsigned k;
+
+    InitChip8(&engine);
+    InitChip8(&reference);
+    SeedChip8(&engine, batch->seed);
+    SeedChip8(&reference, batch->seed);
+    SetQuirkProfile(&engine, rom->quirks);
+    SetQuirkProfile(&reference, rom->quirks);
+    LoadGameFromBuffer(&engine, rom->data, rom->size);
+    LoadGameFromBuffer(&reference, rom->data, rom->size);
+    AttachBlockCache(&engine, batch->caches[0]);
+    for(k=0; k < 0x10; k++)
+        engine.KEY[k] = reference.KEY[k] = (instance >> k) & 0x1;
+
+    result->status = "ok";
+    while((limits->frames == 0 || frame < limits->frames) && (limits->cycles == 0 || executed < limits->cycles))
+    {
+        uint32_t budget = FrameInstructionBudget(limits->ips, frame);
+        uint32_t done = 0;
+        if(limits->cycles && limits->cycles - executed < budget)
+            budget = (uint32_t)(limits->cycles - executed);
+        while(done < budget && !engine.WAIT_KEY)
+        {
+            uint16_t pc = engine.PC;
+            uint32_t n, i;
+            bool ok = StepBlock(&engine, budget - done, &n);
+            for(i=0; i < n; i++)
+                Execute(&reference);
+            done += n;
+            //An unknown opcode retires nothing but has already moved PC past it, the reference has to reject it too
+            const char *field = !ok && Execute(&reference) ? "opcode" : CompareMachines(&engine, &reference);
+            if(field)
+            {
+                fprintf(stderr, "%s #%u: %s differs after the block at 0x%03x, %llu instructions in\n",
+                    rom->path, instance, field, pc, (unsigned long long)(executed + done));
+                result->status = "mismatch";
+                break;
+            }
+            if(!ok) { result->status = "unknown_opcode"; break; }
+        }
+        executed += done;
+        if(strcmp(result->status, "ok") != 0)
+            break;
+        if(engine.WAIT_KEY) { result->status = "waiting_for_key"; break; }
+        TickTimers(&engine);
+        TickTimers(&reference);
+        frame++;
+    }
+    result->instructions = executed;
+    result->frames = frame;
+    result->pc = engine.PC;
+    result->display_hash = HashDisplay(&engine);
+    return strcmp(result->status, "mismatch") != 0;
+}
+
+//The lockstep engine runs the instances of a rom in groups of up to LOCKSTEP_MAX_LANES, split as evenly as they go
+size_t LockstepGroups(const BATCH *batch)
+{
+    return (batch->instances + LOCKSTEP_MAX_LANES - 1) / LOCKSTEP_MAX_LANES;
+}
+
+#define REWIND_CHECK_BYTES (2 * SAVESTATE_SIZE)//the smallest ring CreateRewind() takes, so entries are dropped for room
+
+//Run one job pushing every frame into a rewind ring of `depth` frames. Every `depth` frames the run steps back as far
+//as the ring goes, one frame at a time and all at once in turn, and carries on from there: every restored machine
+//and every frame run again must hash as it did the first time. Returns false on the first mismatch
+bool RewindCheckJob(BATCH *batch, size_t job, unsigned depth, uint64_t *restored)
+{
+    CHIP8 *c8 = &batch->machines[0];
+    const ROM *rom = &batch->roms[job / batch->instances];
+    unsigned instance = (unsigned)(job % batch->instances);
+    const RUN_LIMITS *limits = &batch->limits;
+    RUN_RESULT *result = &batch->results[job];
+    REWIND *history = CreateRewind(REWIND_CHECK_BYTES, depth, REWIND_KEYFRAME_INTERVAL);
+    //HashState() and instructions retired after frame f are at f % depth
+    uint64_t *hashes = (uint64_t*)malloc(depth * sizeof(uint64_t));
+    uint64_t *executed_after = (uint64_t*)malloc(depth * sizeof(uint64_t));
+    uint64_t executed = 0;
+    uint64_t frame = 0;
+    uint64_t run_before = 0;//frames before it already ran once, they are running again after a rewind
+    uint64_t next_check = depth;
+    bool step = true;
+
+    StartJob(batch, c8, 0, job);
+    result->status = "ok";
+    while((limits->frames == 0 || frame < limits->frames) && (limits->cycles == 0 || executed < limits->cycles))
+    {
+        uint32_t budget = FrameInstructionBudget(limits->ips, frame);
+        uint32_t ran = 0;
+        if(limits->cycles && limits->cycles - executed < budget)
+            budget = (uint32_t)(limits->cycles - executed);
+        bool ok = RunFrame(c8, budget, &ran);
+        executed += ran;
+        if(!ok) { result->status = "unknown_opcode"; break; }
+        if(c8->WAIT_KEY) { result->status = "waiting_for_key"; break; }
+        TickTimers(c8);
+        PushRewind(history, c8);
+        uint64_t hash = HashState(c8);
+        if(frame < run_before && hash != hashes[frame % depth])
+        {
+            fprintf(stderr, "%s #%u: frame %llu differs when run again after rewinding\n", rom->path, instance, (unsigned long long)frame);
+            result->status = "mismatch";
+            break;
+        }
+        hashes[frame % depth] = hash;
+        executed_after[frame % depth] = executed;
+        frame++;
+        if(frame > run_before)
+            run_before = frame;
+        if(frame < next_check)
+            continue;
+
+        //The newest entry is the frame just run, walk back from it
+        unsigned back = RewindDepth(history), i;
+        for(i = step ? 1 : back; i && i <= back; i++)
+        {
+            uint64_t target = frame - 1 - i;
+            if(RewindTo(history, c8, step ? 1 : back) && HashState(c8) == hashes[target % depth])
+            {
+                (*restored)++;
+                continue;
+            }
+            fprintf(stderr, "%s #%u: frame %llu differs after rewinding %u frames to it\n", rom->path, instance, (unsigned long long)target, i);
+            result->status = "mismatch";
+            break;
+        }
+        if(strcmp(result->status, "ok") != 0)
+            break;
+        frame -= back;
+        executed = executed_after[(frame - 1) % depth];
+        next_check += depth;
+        step = !step;
+    }
+    result->instructions = executed;
+    result->frames = frame;
+    result->pc = c8->PC;
+    result->display_hash = HashDisplay(c8);
+    result->state_hash = HashState(c8);
+    result->idle_instructions = c8->idle_instructions;
+    DestroyRewind(history);
+    free(hashes);
+    free(executed_after);
+    return strcmp(result->status, "mismatch") != 0;
+}
+
+//Run the jobs of one lockstep group as the lanes of a single LOCKSTEP, each gets the result RunMachine() would give it
+void RunLockstepJob(void *userdata, unsigned worker, size_t task)
+{
+    BATCH *batch = (BATCH*)userdata;
+    LOCKSTEP *ls = batch->locksteps[worker];
+    size_t groups = LockstepGroups(batch);
+    size_t rom_index = task / groups, group = task % groups;
+    const ROM *rom = &batch->roms[rom_index];
+    unsigned first = (unsigned)(group * batch->instances / groups);
+    unsigned lanes = (unsigned)((group + 1) * batch->instances / groups) - first;
+    RUN_RESULT *results = &batch->results[rom_index * batch->instances + first];
+    const RUN_LIMITS *limits = &batch->limits;
+    uint64_t executed = 0;
+    uint64_t frame = 0;
+    unsigned l, k;
+
+    InitLockstep(ls, lanes, rom->quirks, rom->data, rom->size, batch->seed);
+    for(l=0; l < lanes; l++)
+    {
+        for(k=0; k < 0x10; k++)
+            ls->machines[l].KEY[k] = ((first + l) >> k) & 0x1;
+        results[l].status = NULL;
+    }
+    while((limits->frames == 0 || frame < limits->frames) && (limits->cycles == 0 || executed < limits->cycles) && ls->running)
+    {
+        uint32_t budget = FrameInstructionBudget(limits->ips, frame);
+        if(limits->cycles && limits->cycles - executed < budget)
+            budget = (uint32_t)(limits->cycles - executed);
+        RunLockstep(ls, budget);
+        executed += budget;
+        //Lanes that stopped this frame end without its timer tick, like a single machine would
+        for(l=0; l < lanes; l++)
+        {
+            if(results[l].status || ls->status[l] == LANE_RUNNING)
+                continue;
+            results[l].status = ls->status[l] == LANE_FAILED ? "unknown_opcode" : "waiting_for_key";
+            results[l].frames = frame;
+        }
+        TickLockstepTimers(ls);
+        frame++;
+    }
+    FlushLockstep(ls);
+    for(l=0; l < lanes; l++)
+    {
+        const CHIP8 *c8 = &ls->machines[l];
+        RUN_RESULT *result = &results[l];
+        if(result->status == NULL)
+        {
+            result->status = "ok";
+            result->frames = frame;
+        }
+        result->instructions = ls->executed[l];
+        result->pc = c8->PC;
+        result->display_hash = HashDisplay(c8);
+        result->frame_hash = INITIAL_FRAME_HASH;
+        result->state_hash = HashState(c8);
+        result->idle_instructions = c8->idle_instructions;
+    }
+}
+
+//Run every job of the batch on `threads` threads, returns the wall time
+double RunBatch(BATCH *batch, size_t jobs, unsigned threads)
+{
+    double start = WallTime();
+    if(batch->engine == ENGINE_LOCKSTEP)
+        RunJobs(threads, jobs / batch->instances * LockstepGroups(batch), RunLockstepJob, batch);
+    else
+        RunJobs(threads, jobs, RunBatchJob, batch);
+    return WallTime() - start;
+}
+
+uint64_t TotalInstructions(const BATCH *batch, size_t jobs)
+{
+    uint64_t total = 0;
+    size_t j;
+    for(j=0; j < jobs; j++)
+        total += batch->results[j].instructions;
+    return total;
+}
+
+void PrintUsage(const char *exe)
+{
+    printf("Usage: %s <rom>... [-c cycles] [-f frames] [-i ips] [-n instances] [-j threads] [-e engine] [-x] [-b frames] [-w file] [-l state] [-d state] [-p file] [-R seed] [-r log] [-t file] [-v target] [-V format] [-u] [-q profile] [-Q file] [-s] [-o text|json]\n", exe);
+    printf("  -c cycles   stop after this many instructions\n");
+    printf("  -f frames   stop after this many 60Hz frames\n");
+    printf("  -i ips      emulated instructions per second, sets how many run per frame (default %u)\n", DEFAULT_IPS);
+    printf("  -n count    run every rom this many times, instance i holds down the keys in the bits of i\n");
+    printf("  -j threads  worker threads for the batch (default: all hardware threads)\n");
+    printf("  -e engine   interpreter, blocks to run predecoded basic blocks (default), jit to also compile hot blocks, or\n");
+    printf("              lockstep to run up to %u instances of a rom per thread with vector instructions\n", LOCKSTEP_MAX_LANES);
+    printf("  -x          run every job on the engine and the interpreter side by side and stop at the first difference,\n");
+    printf("              with lockstep run the batch on both, compare every final machine and compare their speed\n");
+    printf("  -b frames   run every job through a rewind ring of this many frames, stepping back through it every as many\n");
+    printf("              frames and stopping at the first restored or rerun frame that differs from its first run\n");
+    printf("  -w file     write the beeper output of a single job to a %u Hz 8-bit wav file\n", AUDIO_RATE);
+    printf("  -l state    start every job from a save state instead of power-on\n");
+    printf("  -d state    save the final state of a single job\n");
+    printf("  -p file     write a profile of every job, csv if the name ends in .csv, json otherwise (needs a CHIP8_PROFILE build)\n");
+    printf("  -v target   stream the display of a single job after every frame to a file, fd:N or |command\n");
+    printf("  -V format   format of -v, y4m (default) or raw for 1 bit per pixel\n");
+    printf("  -u          leave out of -v every frame identical to the one before, and stamp the rest with their frame\n");
+    printf("  -q profile  quirks: default, vip, chip48, schip or auto to look each rom up in the database (default auto)\n");
+    printf("  -Q file     quirk database read by -q auto (default $CHIP8_QUIRKS_DB or %s)\n", QUIRK_DATABASE_FILE);
+    printf("  -R seed     seed of the 0xC000 random generator (default %u)\n", DEFAULT_SEED);
+    printf("  -r log      replay an input log recorded by the SDL front end, its seed and speed are used\n");
+    printf("  -t file     write the rolling hash of the display and registers after every frame of a single job\n");
+    printf("  -s          run the batch on 1, 2, 4... threads and report how throughput scales\n");
+    printf("  -o format   report format, text (default) or json\n");
+}
+
+//Block cache counters summed over every worker
+void PrintBlockCacheStats(const BATCH *batch, unsigned threads, OUTPUT_FORMAT format)
+{
+    BLOCK_CACHE total;
+    unsigned t;
+    JIT jit;
+    if(batch->engine != ENGINE_BLOCKS && batch->engine != ENGINE_JIT)
+        return;
+    memset(&total, 0, sizeof(total));
+    memset(&jit, 0, sizeof(jit));
+    for(t=0; t < threads; t++)
+    {
+        total.lookups += batch->caches[t]->lookups;
+        total.hits += batch->caches[t]->hits;
+        total.blocks_built += batch->caches[t]->blocks_built;
+        total.invalidations += batch->caches[t]->invalidations;
+        total.flushes += batch->caches[t]->flushes;
+        if(batch->caches[t]->jit)
+        {
+            jit.blocks_compiled += batch->caches[t]->jit->blocks_compiled;
+            jit.native_instructions += batch->caches[t]->jit->native_instructions;
+            jit.handler_calls += batch->caches[t]->jit->handler_calls;
+        }
+    }
+    double hit_rate = total.lookups ? (double)total.hits / (double)total.lookups : 0.0;
+    if(format == OUTPUT_JSON)
+        printf(",\"block_cache\":{\"lookups\":%llu,\"hit_rate\":%.6f,\"blocks_built\":%llu,\"invalidations\":%llu,\"flushes\":%llu}",
+            (unsigned long long)total.lookups, hit_rate, (unsigned long long)total.blocks_built, (unsigned long long)total.invalidations, (unsigned long long)total.flushes);
+    else
+        printf("block cache:  %.2f%% hits over %llu lookups, %llu blocks built, %llu invalidations, %llu flushes\n",
+            hit_rate * 100.0, (unsigned long long)total.lookups, (unsigned long long)total.blocks_built, (unsigned long long)total.invalidations, (unsigned long long)total.flushes);
+    if(batch->engine != ENGINE_JIT)
+        return;
+    if(format == OUTPUT_JSON)
+        printf(",\"jit\":{\"blocks_compiled\":%llu,\"native_instructions\":%llu,\"handler_calls\":%llu}",
+            (unsigned long long)jit.blocks_compiled, (unsigned long long)jit.native_instructions, (unsigned long long)jit.handler_calls);
+    else
+        printf("jit:          %llu blocks compiled, %llu instructions native, %llu through handlers\n",
+            (unsigned long long)jit.blocks_compiled, (unsigned long long)jit.native_instructions, (unsigned long long)jit.handler_calls);
+}
+
+//Lockstep counters summed over every worker, and the throughput of a single core
+void PrintLockstepStats(const BATCH *batch, size_t jobs, unsigned threads, double elapsed, OUTPUT_FORMAT format)
+{
+    uint64_t steps = 0, vector = 0, scalar = 0;
+    unsigned t;
+    if(batch->engine != ENGINE_LOCKSTEP)
+        return;
+    for(t=0; t < threads; t++)
+    {
+        steps += batch->locksteps[t]->steps;
+        vector += batch->locksteps[t]->vector_instructions;
+        scalar += batch->locksteps[t]->scalar_instructions;
+    }
+    size_t tasks = jobs / batch->instances * LockstepGroups(batch);
+    double cpu = elapsed * (tasks < threads ? tasks : threads);
+    double per_core = cpu > 0.0 ? (double)TotalInstructions(batch, jobs) / cpu : 0.0;
+    double share = vector + scalar ? (double)vector / (double)(vector + scalar) : 0.0;
+    double width = steps ? (double)(vector + scalar) / (double)steps : 0.0;
+    if(format == OUTPUT_JSON)
+        printf(",\"lockstep\":{\"simd\":\"%s\",\"steps\":%llu,\"lanes_per_step\":%.2f,\"vectorized\":%.6f,\"ips_per_core\":%.0f}",
+            LOCKSTEP_INSTRUCTIONS, (unsigned long long)steps, width, share, per_core);
+    else
+        printf("lockstep:     %s, %llu steps of %.2f lanes on average, %.2f%% of lane instructions vectorized, %.0f ips per core\n",
+            LOCKSTEP_INSTRUCTIONS, (unsigned long long)steps, width, share * 100.0, per_core);
+}
+
+//Idle loops cost nothing, so the time they saved is estimated from what the instructions that did run cost
+void PrintIdleStats(const BATCH *batch, size_t jobs, unsigned threads, double elapsed, OUTPUT_FORMAT format)
+{
+    uint64_t instructions = 0, idle = 0, frames = 0;
+    double execute_time = 0.0;
+    size_t j;
+    for(j=0; j < jobs; j++)
+    {
+        instructions += batch->results[j].instructions;
+        idle += batch->results[j].idle_instructions;
+        frames += batch->results[j].frames;
+        execute_time += batch->results[j].execute_time;
+    }
+    //Writing the outputs isn't part of what the skipped instructions would have cost
+    double cpu = HasFrameOutput(batch) ? execute_time : elapsed * (jobs < threads ? jobs : threads);
+    double saved = instructions > idle ? cpu * (double)idle / (double)(instructions - idle) : 0.0;
+    double per_second = frames ? saved * 1000.0 * TIMER_HZ / (double)frames : 0.0;
+    if(format == OUTPUT_JSON)
+        printf(",\"idle\":{\"instructions\":%llu,\"cpu_ms_saved_per_second\":%.3f}", (unsigned long long)idle, per_second);
+    else
+        printf("idle loops:   %llu instructions skipped (%.2f%%), about %.3f ms of cpu saved per emulated second\n",
+            (unsigned long long)idle, instructions ? 100.0 * (double)idle / (double)instructions : 0.0, per_second);
+}
+
+int main(int argc, char *argv[])
+{
+    const char **paths = (const char**)calloc(argc, sizeof(char*));
+    unsigned rom_count = 0;
+    RUN_LIMITS limits = {0, 0, DEFAULT_IPS};
+    unsigned instances = 1;
+    unsigned threads = 0;
+    bool sweep = false;
+    bool cross_check = false;
+    unsigned rewind_depth = 0;
+    const char *wav_path = NULL;
+    const char *load_path = NULL;
+    const char *dump_path = NULL;
+    const char *profile_path = NULL;
+    const char *replay_path = NULL;
+    const char *trace_path = NULL;
+    const char *video_path = NULL;
+    STREAM_FORMAT video_format = STREAM_Y4M;
+    bool video_unique = false;
+    const char *quirk_database = getenv("CHIP8_QUIRKS_DB") ? getenv("CHIP8_QUIRKS_DB") : QUIRK_DATABASE_FILE;
+    bool auto_quirks = true;
+    QUIRK_PROFILE quirks = QUIRKS_DEFAULT;
+    uint64_t seed = DEFAULT_SEED;
+    ENGINE engine = ENGINE_BLOCKS;
+    OUTPUT_FORMAT format = OUTPUT_TEXT;
+    int a;
+    for(a=1; a < argc; a++)
+    {
+        if(strcmp(argv[a], "-c") == 0 && a + 1 < argc)
+            limits.cycles = strtoull(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-f") == 0 && a + 1 < argc)
+            limits.frames = strtoull(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-i") == 0 && a + 1 < argc)
+            limits.ips = (uint32_t)strtoul(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-n") == 0 && a + 1 < argc)
+            instances = (unsigned)strtoul(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-j") == 0 && a + 1 < argc)
+            threads = (unsigned)strtoul(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "-e") == 0 && a + 1 < argc)
+        {
+            a++;
+            if(strcmp(argv[a], "interpreter") == 0) engine = ENGINE_INTERPRETER;
+            else if(strcmp(argv[a], "blocks") == 0) engine = ENGINE_BLOCKS;
+            else if(strcmp(argv[a], "jit") == 0) engine = ENGINE_JIT;
+            else if(strcmp(argv[a], "lockstep") == 0) engine = ENGINE_LOCKSTEP;
+            else { PrintUsage(argv[0]); return 1; }
+        }
+        else if(strcmp(argv[a], "-s") == 0)
+            sweep = true;
+        else if(strcmp(argv[a], "-x") == 0)
+            cross_check = true;
+        else if(strcmp(argv[a], "-b") == 0 && a + 1 < argc)
+        {
+            //A ring of one frame has nothing to step back to
+            rewind_depth = (unsigned)strtoul(argv[++a], NULL, 10);
+            if(rewind_depth < 2) { PrintUsage(argv[0]); return 1; }
+        }
+        else if(strcmp(argv[a], "-w") == 0 && a + 1 < argc)
+            wav_path = argv[++a];
+        else if(strcmp(argv[a], "-l") == 0 && a + 1 < argc)
+            load_path = argv[++a];
+        else if(strcmp(argv[a], "-d") == 0 && a + 1 < argc)
+            dump_path = argv[++a];
+        else if(strcmp(argv[a], "-p") == 0 && a + 1 < argc)
+            profile_path = argv[++a];
+        else if(strcmp(argv[a], "-R") == 0 && a + 1 < argc)
+            seed = strtoull(argv[++a], NULL, 0);
+        else if(strcmp(argv[a], "-r") == 0 && a + 1 < argc)
+            replay_path = argv[++a];
+        else if(strcmp(argv[a], "-t") == 0 && a + 1 < argc)
+            trace_path = argv[++a];
+        else if(strcmp(argv[a], "-v") == 0 && a + 1 < argc)
+            video_path = argv[++a];
+        else if(strcmp(argv[a], "-V") == 0 && a + 1 < argc)
+        {
+            a++;
+            if(strcmp(argv[a], "y4m") == 0) video_format = STREAM_Y4M;
+            else if(strcmp(argv[a], "raw") == 0) video_format = STREAM_RAW;
+            else { PrintUsage(argv[0]); return 1; }
+        }
+        else if(strcmp(argv[a], "-u") == 0)
+            video_unique = true;
+        else if(strcmp(argv[a], "-q") == 0 && a + 1 < argc)
+        {
+            a++;
+            auto_quirks = strcmp(argv[a], "auto") == 0;
+            if(!auto_quirks && !ParseQuirkProfile(argv[a], &quirks)) { PrintUsage(argv[0]); return 1; }
+        }
+        else if(strcmp(argv[a], "-Q") == 0 && a + 1 < argc)
+            quirk_database = argv[++a];
+        else if(strcmp(argv[a], "-o") == 0 && a + 1 < argc)
+        {
+            a++;
+            if(strcmp(argv[a], "json") == 0) format = OUTPUT_JSON;
+            else if(strcmp(argv[a], "text") == 0) format = OUTPUT_TEXT;
+            else { PrintUsage(argv[0]); return 1; }
+        }
+        else if(argv[a][0] != '-')
+            paths[rom_count++] = argv[a];
+        else { PrintUsage(argv[0]); return 1; }
+    }
+
+    //A replay brings its own seed, speed and length
+    static INPUT_REPLAY replay;
+    if(replay_path)
+    {
+        if(!LoadReplay(&replay, replay_path))
+        {
+            fprintf(stderr, "%s is not a version %u input log\n", replay_path, INPUT_LOG_VERSION);
+            return 1;
+        }
+        seed = replay.seed;
+        limits.ips = replay.ips;
+    }
+
+    if(rom_count == 0 || (limits.cycles == 0 && limits.frames == 0 && !replay_path) || limits.ips == 0 || instances == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    //Without -q every rom gets the profile the database has for it
+    QUIRK_DATABASE database = {NULL, 0};
+    if(auto_quirks)
+    {
+        LoadQuirkDatabase(&database, quirk_database);
+        if(database.count == 0)
+            fprintf(stderr, "Quirk database %s is missing or has no entries, every rom runs with the default profile\n", quirk_database);
+    }
+    ROM *roms = (ROM*)calloc(rom_count, sizeof(ROM));
+    unsigned r;
+    for(r=0; r < rom_count; r++)
+    {
+        if(!ReadRom(&roms[r], paths[r]))
+        {
+            fprintf(stderr, "Unable to open rom %s\n", paths[r]);
+            return 42;
+        }
+        roms[r].quirks = auto_quirks ? LookupQuirkProfile(&database, roms[r].data, roms[r].size, QUIRKS_DEFAULT) : quirks;
+    }
+    FreeQuirkDatabase(&database);
+
+    BuildDecodeTable();
+
+    unsigned max_threads = HardwareThreads();
+    if(threads == 0)
+        threads = max_threads;
+    if(sweep && threads < max_threads)
+        threads = max_threads;
+    if(rewind_depth && (cross_check || sweep || engine == ENGINE_LOCKSTEP || dump_path || profile_path || replay_path || trace_path || wav_path || video_path))
+    {
+        fprintf(stderr, "-b checks plain batches, it can't be combined with -x, -s, -e lockstep, -d, -p, -r, -t, -w or -v\n");
+        return 1;
+    }
+    if(cross_check || rewind_depth)
+    {
+        threads = 1;
+        sweep = false;
+    }
+
+    size_t jobs = (size_t)rom_count * instances;
+    BATCH batch;
+    batch.roms = roms;
+    batch.instances = instances;
+    batch.limits = limits;
+    batch.engine = engine;
+    batch.machines = (CHIP8*)calloc(threads, sizeof(CHIP8));
+    batch.caches = (BLOCK_CACHE**)calloc(threads, sizeof(BLOCK_CACHE*));
+    if(engine == ENGINE_JIT && !JIT_SUPPORTED)
+    {
+        fprintf(stderr, "The jit is not available on this host, running blocks\n");
+        batch.engine = engine = ENGINE_BLOCKS;
+    }
+    if(cross_check && engine == ENGINE_INTERPRETER)
+    {
+        fprintf(stderr, "Nothing to cross-check the interpreter against, pick -e blocks or -e jit\n");
+        return 1;
+    }
+    if(engine == ENGINE_LOCKSTEP && (load_path || dump_path || profile_path || replay_path || trace_path || wav_path || video_path))
+    {
+        fprintf(stderr, "-e lockstep runs plain batches, it can't be combined with -l, -d, -p, -r, -t, -w or -v\n");
+        return 1;
+    }
+    if(engine == ENGINE_BLOCKS || engine == ENGINE_JIT)
+    {
+        unsigned t;
+        for(t=0; t < threads; t++)
+        {
+            batch.caches[t] = CreateBlockCache();
+            if(engine == ENGINE_JIT)
+                batch.caches[t]->jit = CreateJit();
+        }
+    }
+    batch.locksteps = (LOCKSTEP**)calloc(threads, sizeof(LOCKSTEP*));
+    if(engine == ENGINE_LOCKSTEP)
+    {
+        unsigned t;
+        for(t=0; t < threads; t++)
+            batch.locksteps[t] = CreateLockstep();
+    }
+    batch.results = (RUN_RESULT*)calloc(jobs, sizeof(RUN_RESULT));
+    batch.wav = NULL;
+    batch.start_state = NULL;
+    if(load_path)
+    {
+        //Read and validate the state once, every job restores it from memory
+        static CHIP8 probe;
+        static uint8_t state[SAVESTATE_SIZE];
+        InitChip8(&probe);
+        if(!LoadStateFile(&probe, load_path))
+        {
+            fprintf(stderr, "%s is not a version %u save state\n", load_path, SAVESTATE_VERSION);
+            return 1;
+        }
+        SaveState(&probe, state);
+        batch.start_state = state;
+    }
+    batch.seed = seed;
+    batch.replay = replay_path ? &replay : NULL;
+    batch.trace = NULL;
+    if((replay_path || trace_path) && (jobs != 1 || sweep || cross_check))
+    {
+        fprintf(stderr, "-r and -t run a single job, pass one rom without -n, -s or -x\n");
+        return 1;
+    }
+    if(trace_path)
+    {
+        batch.trace = fopen(trace_path, "w");
+        if(batch.trace == NULL)
+        {
+            fprintf(stderr, "Unable to create %s\n", trace_path);
+            return 1;
+        }
+    }
+    batch.profiles = NULL;
+    if(profile_path)
+    {
+#ifdef CHIP8_PROFILE
+        unsigned t;
+        batch.profiles = (PROFILE*)calloc(threads, sizeof(PROFILE));
+        for(t=0; t < threads; t++)
+            ResetProfile(&batch.profiles[t]);
+#else
+        fprintf(stderr, "-p needs a build with CHIP8_PROFILE defined\n");
+        return 1;
+#endif
+    }
+    if(dump_path && (jobs != 1 || sweep || cross_check))
+    {
+        fprintf(stderr, "-d saves a single job, pass one rom without -n, -s or -x\n");
+        return 1;
+    }
+    if(wav_path)
+    {
+        if(jobs != 1 || sweep || cross_check)
+        {
+            fprintf(stderr, "-w records a single job, pass one rom without -n, -s or -x\n");
+            return 1;
+        }
+        batch.wav = (WAV_OUTPUT*)calloc(1, sizeof(WAV_OUTPUT));
+        batch.wav->file = fopen(wav_path, "wb");
+        if(batch.wav->file == NULL)
+        {
+            fprintf(stderr, "Unable to create %s\n", wav_path);
+            return 1;
+        }
+        InitBeeper(&batch.wav->beeper, AUDIO_RATE, 0);
+        WriteWavHeader(batch.wav->file, AUDIO_RATE, 0);
+    }
+    batch.video = NULL;
+    if(video_path)
+    {
+        if(jobs != 1 || sweep || cross_check)
+        {
+            fprintf(stderr, "-v records a single job, pass one rom without -n, -s or -x\n");
+            return 1;
+        }
+#ifndef _WIN32
+        //A reader that goes away fails the writes, reported at the end, instead of killing the run
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        batch.video = OpenFrameStream(video_path, video_format, video_unique);
+        if(batch.video == NULL)
+        {
+            fprintf(stderr, "Unable to open %s\n", video_path);
+            return 1;
+        }
+    }
+
+    if(sweep)
+    {
+        //Aggregate throughput for 1, 2, 4... threads up to all hardware threads
+        unsigned t = 1;
+        double single = 0.0;
+        if(format == OUTPUT_JSON) printf("[");
+        for(;;)
+        {
+            double elapsed = RunBatch(&batch, jobs, t);
+            double ips = elapsed > 0.0 ? (double)TotalInstructions(&batch, jobs) / elapsed : 0.0;
+            if(t == 1) single = ips;
+            if(format == OUTPUT_JSON)
+                printf("%s{\"threads\":%u,\"wall_time\":%.6f,\"ips\":%.0f,\"speedup\":%.2f}", t == 1 ? "" : ",", t, elapsed, ips, single > 0.0 ? ips / single : 0.0);
+            else
+                printf("threads: %3u  wall time: %.6f s  ips: %.0f  speedup: %.2fx\n", t, elapsed, ips, single > 0.0 ? ips / single : 0.0);
+            if(t == threads) break;
+            t = (t * 2 > threads) ? threads : t * 2;
+        }
+        if(format == OUTPUT_JSON) printf("]\n");
+        return 0;
+    }
+
+    if(cross_check && engine == ENGINE_LOCKSTEP)
+    {
+        //Run the batch twice on one thread and compare every final machine, the timings compare a core of each
+        size_t j;
+        double elapsed = RunBatch(&batch, jobs, 1);
+        uint64_t total = TotalInstructions(&batch, jobs);
+        RUN_RESULT *lockstep = (RUN_RESULT*)malloc(jobs * sizeof(RUN_RESULT));
+        memcpy(lockstep, batch.results, jobs * sizeof(RUN_RESULT));
+        batch.engine = ENGINE_INTERPRETER;
+        double reference = RunBatch(&batch, jobs, 1);
+        batch.engine = ENGINE_LOCKSTEP;
+        for(j=0; j < jobs; j++)
+        {
+            const RUN_RESULT *a = &lockstep[j], *b = &batch.results[j];
+            const char *field = strcmp(a->status, b->status) != 0 ? "status"
+                : a->instructions != b->instructions ? "instructions"
+                : a->frames != b->frames ? "frames"
+                : a->pc != b->pc ? "pc"
+                : a->display_hash != b->display_hash ? "display"
+                : a->state_hash != b->state_hash ? "state" : NULL;
+            if(field)
+            {
+                fprintf(stderr, "%s #%u: %s differs from the interpreter\n", roms[j / instances].path, (unsigned)(j % instances), field);
+                return 46;
+            }
+        }
+        double ips = elapsed > 0.0 ? (double)total / elapsed : 0.0;
+        double scalar = reference > 0.0 ? (double)total / reference : 0.0;
+        printf("cross-check:  %llu jobs, %llu instructions, no differences\n", (unsigned long long)jobs, (unsigned long long)total);
+        printf("lockstep:     %.6f s, %.0f ips per core\n", elapsed, ips);
+        printf("interpreter:  %.6f s, %.0f ips per core\n", reference, scalar);
+        printf("speedup:      %.2fx\n", scalar > 0.0 ? ips / scalar : 0.0);
+        PrintLockstepStats(&batch, jobs, 1, elapsed, OUTPUT_TEXT);
+        free(lockstep);
+        return 0;
+    }
+
+    if(cross_check)
+    {
+        size_t j;
+        uint64_t total = 0;
+        for(j=0; j < jobs; j++)
+        {
+            if(!CrossCheckJob(&batch, j))
+                return 46;
+            total += batch.results[j].instructions;
+        }
+        printf("cross-check:  %llu jobs, %llu instructions, no differences\n", (unsigned long long)jobs, (unsigned long long)total);
+        PrintBlockCacheStats(&batch, threads, OUTPUT_TEXT);
+        return 0;
+    }
+
+    if(rewind_depth)
+    {
+        size_t j;
+        uint64_t frames = 0, restored = 0;
+        for(j=0; j < jobs; j++)
+        {
+            if(!RewindCheckJob(&batch, j, rewind_depth, &restored))
+                return 46;
+            frames += batch.results[j].frames;
+        }
+        printf("rewind check: %llu jobs, %llu frames, %llu restored, no differences\n", (unsigned long long)jobs,
+            (unsigned long long)frames, (unsigned long long)restored);
+        return 0;
+    }
+
+    double elapsed = RunBatch(&batch, jobs, threads);
+    if(batch.wav)
+    {
+        WriteWavHeader(batch.wav->file, AUDIO_RATE, batch.wav->samples);
+        fclose(batch.wav->file);
+    }
+    if(batch.trace)
+        fclose(batch.trace);
+    STREAM_STATS video;
+    if(batch.video)
+    {
+        CloseFrameStream(batch.video, &video);
+        if(video.failed)
+        {
+            fprintf(stderr, "Unable to write every frame to %s\n", video_path);
+            return 1;
+        }
+    }
+    if(profile_path && batch.profiles)
+    {
+        PROFILE *total = &batch.profiles[0];
+        unsigned t;
+        for(t=1; t < threads; t++)
+            MergeProfile(total, &batch.profiles[t]);
+        if(!WriteProfile(total, profile_path, ProfileFormatFromPath(profile_path)))
+        {
+            fprintf(stderr, "Unable to write %s\n", profile_path);
+            return 1;
+        }
+    }
+    if(dump_path && !SaveStateFile(&batch.machines[0], dump_path))
+    {
+        fprintf(stderr, "Unable to write %s\n", dump_path);
+        return 1;
+    }
+    double measured_ips = elapsed > 0.0 ? (double)TotalInstructions(&batch, jobs) / elapsed : 0.0;
+    bool failed = false;
+    size_t j;
+    for(j=0; j < jobs; j++)
+        failed |= strcmp(batch.results[j].status, "unknown_opcode") == 0;
+
+    if(jobs == 1)
+    {
+        RUN_RESULT *result = &batch.results[0];
+        if(format == OUTPUT_JSON)
+        {
+            printf("{\"rom\":");
+            PrintJsonString(roms[0].path);
+            printf(",\"rom_hash\":\"%016llx\",\"quirks\":\"%s\"", (unsigned long long)HashRom(roms[0].data, roms[0].size), QuirkProfileName(roms[0].quirks));
+            printf(",\"status\":\"%s\",\"instructions\":%llu,\"frames\":%llu,\"wall_time\":%.6f,\"ips\":%.0f,\"pc\":%u,\"display_hash\":\"%016llx\"",
+                result->status, (unsigned long long)result->instructions, (unsigned long long)result->frames, elapsed, measured_ips, result->pc, (unsigned long long)result->display_hash);
+            if(batch.trace || batch.replay)
+                printf(",\"frame_hash\":\"%016llx\"", (unsigned long long)result->frame_hash);
+            if(batch.video)
+                printf(",\"video\":{\"frames\":%llu,\"written\":%llu,\"duplicates\":%llu,\"stalls\":%llu}", (unsigned long long)video.frames,
+                    (unsigned long long)video.written, (unsigned long long)video.duplicates, (unsigned long long)video.stalls);
+            PrintIdleStats(&batch, jobs, threads, elapsed, format);
+            PrintBlockCacheStats(&batch, threads, format);
+            PrintLockstepStats(&batch, jobs, threads, elapsed, format);
+            printf("}\n");
+        }
+        else
+        {
+            printf("rom:          %s\n", roms[0].path);
+            printf("rom hash:     %016llx\n", (unsigned long long)HashRom(roms[0].data, roms[0].size));
+            printf("quirks:       %s\n", QuirkProfileName(roms[0].quirks));
+            printf("status:       %s\n", result->status);
+            printf("instructions: %llu\n", (unsigned long long)result->instructions);
+            printf("frames:       %llu\n", (unsigned long long)result->frames);
+            printf("wall time:    %.6f s\n", elapsed);
+            printf("ips:          %.0f\n", measured_ips);
+            printf("pc:           0x%03x\n", result->pc);
+            printf("display hash: %016llx\n", (unsigned long long)result->display_hash);
+            if(batch.trace || batch.replay)
+                printf("frame hash:   %016llx\n", (unsigned long long)result->frame_hash);
+            if(batch.video)
+                printf("video:        %llu of %llu frames written, %llu duplicates dropped, emulation waited on the writer %llu times\n",
+                    (unsigned long long)video.written, (unsigned long long)video.frames, (unsigned long long)video.duplicates, (unsigned long long)video.stalls);
+            PrintIdleStats(&batch, jobs, threads, elapsed, format);
+            PrintBlockCacheStats(&batch, threads, format);
+            PrintLockstepStats(&batch, jobs, threads, elapsed, format);
+        }
+        return failed ? 45 : 0;
+    }
+
+    if(format == OUTPUT_JSON)
+    {
+        printf("{\"threads\":%u,\"jobs\":%llu,\"wall_time\":%.6f,\"ips\":%.0f,\"results\":[", threads, (unsigned long long)jobs, elapsed, measured_ips);
+        for(j=0; j < jobs; j++)
+        {
+            RUN_RESULT *result = &batch.results[j];
+            printf("%s{\"rom\":", j ? "," : "");
+            PrintJsonString(roms[j / instances].path);
+            printf(",\"instance\":%u,\"status\":\"%s\",\"instructions\":%llu,\"frames\":%llu,\"pc\":%u,\"display_hash\":\"%016llx\"}",
+                (unsigned)(j % instances), result->status, (unsigned long long)result->instructions, (unsigned long long)result->frames, result->pc, (unsigned long long)result->display_hash);
+        }
+        printf("]");
+        PrintIdleStats(&batch, jobs, threads, elapsed, format);
+        PrintBlockCacheStats(&batch, threads, format);
+        PrintLockstepStats(&batch, jobs, threads, elapsed, format);
+        printf("}\n");
+    }
+    else
+    {
+        for(j=0; j < jobs; j++)
+        {
+            RUN_RESULT *result = &batch.results[j];
+            printf("%s #%u: %s, %llu instructions, %llu frames, pc 0x%03x, display hash %016llx\n",
+                roms[j / instances].path, (unsigned)(j % instances), result->status, (unsigned long long)result->instructions,
+                (unsigned long long)result->frames, result->pc, (unsigned long long)result->display_hash);
+        }
+        printf("threads:      %u\n", threads);
+        printf("jobs:         %llu\n", (unsigned long long)jobs);
+        printf("wall time:    %.6f s\n", elapsed);
+        printf("ips:          %.0f\n", measured_ips);
+        PrintIdleStats(&batch, jobs, threads, elapsed, format);
+        PrintBlockCacheStats(&batch, threads, format);
+        PrintLockstepStats(&batch, jobs, threads, elapsed, format);
+    }
+    return failed ? 45 : 0;
+}
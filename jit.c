@@ -0,0 +1,249 @@
+//mmap() flags are not part of strict ISO C
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include "jit.h"
+
+#if JIT_SUPPORTED
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//Offsets of the machine fields the generated code touches, rbx holds the CHIP8 pointer
+#define OFFSET_V        ((int32_t)offsetof(CHIP8, V))
+#define OFFSET_VF       ((int32_t)(offsetof(CHIP8, V) + 0xF))
+#define OFFSET_I        ((int32_t)offsetof(CHIP8, I_REGISTER))
+#define OFFSET_PC       ((int32_t)offsetof(CHIP8, PC))
+#define OFFSET_OPERANDS ((int32_t)offsetof(CHIP8, operands))
+
+//x86 registers used as ModRM `reg` fields
+#define AL 0
+#define CL 1
+#define DL 2
+
+//Largest code one instruction can emit, with room for the epilogue
+#define MAX_INSTRUCTION_BYTES 64
+
+typedef struct {
+    uint8_t *code;
+    size_t size;
+} EMITTER;
+
+static void Byte(EMITTER *e, uint8_t b) { e->code[e->size++] = b; }
+static void Word(EMITTER *e, uint16_t w) { Byte(e, (uint8_t)w); Byte(e, (uint8_t)(w >> 8)); }
+static void Dword(EMITTER *e, uint32_t d) { Word(e, (uint16_t)d); Word(e, (uint16_t)(d >> 16)); }
+static void Qword(EMITTER *e, uint64_t q) { Dword(e, (uint32_t)q); Dword(e, (uint32_t)(q >> 32)); }
+
+//opcode reg8, [rbx + disp32] and opcode [rbx + disp32], reg8
+static void RegMem(EMITTER *e, uint8_t opcode, uint8_t reg, int32_t disp) { Byte(e, opcode); Byte(e, 0x83 | (reg << 3)); Dword(e, (uint32_t)disp); }
+static void LoadV(EMITTER *e, uint8_t reg, unsigned x)  { RegMem(e, 0x8A, reg, OFFSET_V + (int32_t)x); }//mov reg, V[x]
+static void StoreV(EMITTER *e, uint8_t reg, unsigned x) { RegMem(e, 0x88, reg, OFFSET_V + (int32_t)x); }//mov V[x], reg
+static void StoreVF(EMITTER *e, uint8_t reg)            { RegMem(e, 0x88, reg, OFFSET_VF); }//mov VF, reg
+static void AluAlCl(EMITTER *e, uint8_t opcode)         { Byte(e, opcode); Byte(e, 0xC8); }//op al, cl
+static void SetccDl(EMITTER *e, uint8_t cc)             { Byte(e, 0x0F); Byte(e, cc); Byte(e, 0xC2); }//setcc dl
+
+static void StorePC(EMITTER *e, uint16_t pc)
+{
+    //mov word [rbx + PC], imm16
+    Byte(e, 0x66); Byte(e, 0xC7); Byte(e, 0x83); Dword(e, (uint32_t)OFFSET_PC); Word(e, pc);
+}
+
+//PC = next + (dl ? 2 : 0)
+static void StoreSkipPC(EMITTER *e, uint16_t next)
+{
+    Byte(e, 0x0F); Byte(e, 0xB6); Byte(e, 0xD2);//movzx edx, dl
+    Byte(e, 0x8D); Byte(e, 0x14); Byte(e, 0x55); Dword(e, next);//lea edx, [rdx*2 + next]
+    Byte(e, 0x66); RegMem(e, 0x89, DL, OFFSET_PC);//mov word [rbx + PC], dx
+}
+
+static void CallHandler(EMITTER *e, const CACHED_INSTRUCTION *in, uint16_t next)
+{
+    Byte(e, 0x48); Byte(e, 0xB8); Qword(e, in->operands);//mov rax, operands
+    Byte(e, 0x48); Byte(e, 0x89); Byte(e, 0x83); Dword(e, (uint32_t)OFFSET_OPERANDS);//mov [rbx + operands], rax
+    StorePC(e, next);
+    Byte(e, 0x48); Byte(e, 0x89); Byte(e, 0xDF);//mov rdi, rbx
+    Byte(e, 0x48); Byte(e, 0x89); Byte(e, 0xD9);//mov rcx, rbx
+    Byte(e, 0x48); Byte(e, 0xB8); Qword(e, (uint64_t)(uintptr_t)in->func_ptr);//mov rax, handler
+    Byte(e, 0xFF); Byte(e, 0xD0);//call rax
+}
+
+//Emit one instruction natively, returns false if it has to go through its handler.
+//`wrote_pc` is set when the emitted code already stores the next PC, `quirks` are the QUIRK_* bits of the machine
+static bool EmitNative(EMITTER *e, uint32_t instruction, OPERANDS op, uint16_t next, uint8_t quirks, bool *wrote_pc)
+{
+    unsigned shift_source = (quirks & QUIRK_SHIFT_VY) ? op.Y : op.X;
+    *wrote_pc = false;
+    switch(instruction)
+    {
+        case 0x6000://Vx = KK
+            Byte(e, 0xC6); Byte(e, 0x83); Dword(e, (uint32_t)(OFFSET_V + op.X)); Byte(e, op.KK);
+            return true;
+        case 0x7000://Vx += KK
+            Byte(e, 0x80); Byte(e, 0x83); Dword(e, (uint32_t)(OFFSET_V + op.X)); Byte(e, op.KK);
+            return true;
+        case 0xA000://I = NNN
+            Byte(e, 0x66); Byte(e, 0xC7); Byte(e, 0x83); Dword(e, (uint32_t)OFFSET_I); Word(e, op.NNN);
+            return true;
+        case 0x8000://Vx = Vy
+            LoadV(e, AL, op.Y); StoreV(e, AL, op.X);
+            return true;
+        case 0x8001: case 0x8002: case 0x8003://Vx = Vx OR/AND/XOR Vy
+            LoadV(e, AL, op.X); LoadV(e, CL, op.Y);
+            AluAlCl(e, instruction == 0x8001 ? 0x08 : instruction == 0x8002 ? 0x20 : 0x30);
+            StoreV(e, AL, op.X);
+            if(quirks & QUIRK_VF_RESET)
+            {
+                Byte(e, 0xC6); Byte(e, 0x83); Dword(e, (uint32_t)OFFSET_VF); Byte(e, 0);//mov byte VF, 0
+            }
+            return true;
+        //The flag is written before the result like the handlers do, so X or Y == 0xF behave the same
+        case 0x8004://VF = carry, Vx += Vy
+            LoadV(e, AL, op.X); LoadV(e, CL, op.Y); AluAlCl(e, 0x00); SetccDl(e, 0x92); StoreVF(e, DL);
+            LoadV(e, AL, op.X); LoadV(e, CL, op.Y); AluAlCl(e, 0x00); StoreV(e, AL, op.X);
+            return true;
+        case 0x8005://VF = Vx > Vy, Vx -= Vy
+            LoadV(e, AL, op.X); LoadV(e, CL, op.Y); AluAlCl(e, 0x38); SetccDl(e, 0x97); StoreVF(e, DL);
+            LoadV(e, AL, op.X); LoadV(e, CL, op.Y); AluAlCl(e, 0x28); StoreV(e, AL, op.X);
+            return true;
+        case 0x8007://VF = Vy > Vx, Vx = Vy - Vx
+            LoadV(e, AL, op.Y); LoadV(e, CL, op.X); AluAlCl(e, 0x38); SetccDl(e, 0x97); StoreVF(e, DL);
+            LoadV(e, AL, op.Y); LoadV(e, CL, op.X); AluAlCl(e, 0x28); StoreV(e, AL, op.X);
+            return true;
+        case 0x8006://VF = Vx & 1, Vx = Vx >> 1 (Vy with QUIRK_SHIFT_VY)
+            LoadV(e, AL, shift_source); Byte(e, 0x24); Byte(e, 0x01); StoreVF(e, AL);
+            LoadV(e, AL, shift_source); Byte(e, 0xD0); Byte(e, 0xE8); StoreV(e, AL, op.X);
+            return true;
+        case 0x800E://VF = Vx >> 7, Vx = Vx << 1 (Vy with QUIRK_SHIFT_VY)
+            LoadV(e, AL, shift_source); Byte(e, 0xC0); Byte(e, 0xE8); Byte(e, 0x07); StoreVF(e, AL);
+            LoadV(e, AL, shift_source); Byte(e, 0xD0); Byte(e, 0xE0); StoreV(e, AL, op.X);
+            return true;
+        case 0x3000: case 0x4000://skip if Vx ==/!= KK
+            Byte(e, 0x80); Byte(e, 0xBB); Dword(e, (uint32_t)(OFFSET_V + op.X)); Byte(e, op.KK);//cmp byte V[x], KK
+            SetccDl(e, instruction == 0x3000 ? 0x94 : 0x95);
+            StoreSkipPC(e, next);
+            *wrote_pc = true;
+            return true;
+        case 0x5000: case 0x9000://skip if Vx ==/!= Vy
+            LoadV(e, AL, op.X);
+            RegMem(e, 0x3A, AL, OFFSET_V + op.Y);//cmp al, V[y]
+            SetccDl(e, instruction == 0x5000 ? 0x94 : 0x95);
+            StoreSkipPC(e, next);
+            *wrote_pc = true;
+            return true;
+    }
+    return false;
+}
+
+JIT *CreateJit()
+{
+    JIT *jit = (JIT*)calloc(1, sizeof(JIT));
+    if(jit == NULL)
+        return NULL;
+#ifdef _WIN32
+    jit->arena = (uint8_t*)VirtualAlloc(NULL, JIT_ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    jit->arena = (uint8_t*)mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(jit->arena == (uint8_t*)MAP_FAILED)
+        jit->arena = NULL;
+#endif
+    if(jit->arena == NULL)
+    {
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void DestroyJit(JIT *jit)
+{
+    if(jit == NULL)
+        return;
+#ifdef _WIN32
+    VirtualFree(jit->arena, 0, MEM_RELEASE);
+#else
+    munmap(jit->arena, JIT_ARENA_SIZE);
+#endif
+    free(jit);
+}
+
+void ResetJit(JIT *jit)
+{
+    jit->used = 0;
+}
+
+//The arena is writable or executable, never both
+static void SetArenaWritable(JIT *jit, bool writable)
+{
+#ifdef _WIN32
+    DWORD old;
+    VirtualProtect(jit->arena, JIT_ARENA_SIZE, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old);
+#else
+    mprotect(jit->arena, JIT_ARENA_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#endif
+}
+
+NATIVE_BLOCK CompileBlock(JIT *jit, uint16_t start, const CACHED_INSTRUCTION *code, unsigned count, uint8_t quirks)
+{
+    if(jit->used + (size_t)(count + 1) * MAX_INSTRUCTION_BYTES > JIT_ARENA_SIZE)
+        return NULL;
+
+    SetArenaWritable(jit, true);
+    EMITTER e;
+    e.code = jit->arena + jit->used;
+    e.size = 0;
+
+    //push rbx; mov rbx, <first argument>; sub rsp, 32 (keeps the stack aligned and gives Win64 its shadow space)
+    Byte(&e, 0x53);
+#ifdef _WIN32
+    Byte(&e, 0x48); Byte(&e, 0x89); Byte(&e, 0xCB);
+#else
+    Byte(&e, 0x48); Byte(&e, 0x89); Byte(&e, 0xFB);
+#endif
+    Byte(&e, 0x48); Byte(&e, 0x83); Byte(&e, 0xEC); Byte(&e, 0x20);
+
+    unsigned i;
+    bool wrote_pc = false;
+    for(i=0; i < count; i++)
+    {
+        OPERANDS op;
+        op.packed = code[i].operands;
+        uint16_t next = (uint16_t)(start + 2 * (i + 1));
+        if(EmitNative(&e, INSTRUCTION_SET[DECODE_TABLE[op.OPCODE]].opcode, op, next, quirks, &wrote_pc))
+            jit->native_instructions++;
+        else
+        {
+            CallHandler(&e, &code[i], next);
+            wrote_pc = true;
+            jit->handler_calls++;
+        }
+    }
+    if(!wrote_pc)
+        StorePC(&e, (uint16_t)(start + 2 * count));
+
+    //add rsp, 32; pop rbx; ret
+    Byte(&e, 0x48); Byte(&e, 0x83); Byte(&e, 0xC4); Byte(&e, 0x20);
+    Byte(&e, 0x5B);
+    Byte(&e, 0xC3);
+
+    NATIVE_BLOCK block = (NATIVE_BLOCK)(void*)e.code;
+    jit->used += (e.size + 15) & ~(size_t)15;
+    jit->blocks_compiled++;
+    SetArenaWritable(jit, false);
+    return block;
+}
+
+#else
+
+JIT *CreateJit() { return NULL; }
+void DestroyJit(JIT *jit) { (void)jit; }
+void ResetJit(JIT *jit) { (void)jit; }
+NATIVE_BLOCK CompileBlock(JIT *jit, uint16_t start, const CACHED_INSTRUCTION *code, unsigned count, uint8_t quirks)
+{
+    (void)jit; (void)start; (void)code; (void)count; (void)quirks;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "blockcache.h"
+
+//x86-64 backend for hot cached blocks. 0x6000, 0x7000, 0x8000-0x800E, 0xA000 and the register/immediate skips are
+//translated to native code, every other instruction is emitted as a call to its chip8_func_* handler.
+//Native code lives in one executable arena that is dropped together with the block cache when either fills up.
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(CHIP8_NO_JIT)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#define JIT_ARENA_SIZE (1024 * 1024)
+#define JIT_THRESHOLD 16//runs of a cached block before it is compiled
+
+typedef struct JIT {
+    uint8_t *arena;
+    size_t used;
+    uint64_t blocks_compiled;
+    uint64_t native_instructions;//instructions translated to native code
+    uint64_t handler_calls;//instructions emitted as calls to their handler
+} JIT;
+
+//Returns NULL when the host can't run the backend
+JIT *CreateJit();
+void DestroyJit(JIT *jit);
+//Forget every compiled block
+void ResetJit(JIT *jit);
+//Translate a cached block of a machine with the QUIRK_* bits `quirks`, returns NULL when the arena is full
+NATIVE_BLOCK CompileBlock(JIT *jit, uint16_t start, const CACHED_INSTRUCTION *code, unsigned count, uint8_t quirks);
+
+#endif
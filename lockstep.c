@@ -0,0 +1,499 @@
+#include "lockstep.h"
+
+//Thin layer over the vector instructions: VEC_BYTES lanes of byte registers or VEC_WORDS lanes of 16-bit ones at a time.
+//Masks are 0xFF/0xFFFF for the lanes selected and 0 for the rest
+#if LOCKSTEP_SIMD && defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i VEC;
+#define VEC_BYTES 32
+#define V_LOAD(p)          _mm256_loadu_si256((const __m256i*)(p))
+#define V_STORE(p, v)      _mm256_storeu_si256((__m256i*)(p), v)
+#define V_SET8(b)          _mm256_set1_epi8((char)(b))
+#define V_SET16(w)         _mm256_set1_epi16((short)(w))
+#define V_ZERO()           _mm256_setzero_si256()
+#define V_ADD8(a, b)       _mm256_add_epi8(a, b)
+#define V_SUB8(a, b)       _mm256_sub_epi8(a, b)
+#define V_ADD16(a, b)      _mm256_add_epi16(a, b)
+#define V_SUBS8U(a, b)     _mm256_subs_epu8(a, b)
+#define V_SUBS16U(a, b)    _mm256_subs_epu16(a, b)
+#define V_AND(a, b)        _mm256_and_si256(a, b)
+#define V_ANDNOT(m, a)     _mm256_andnot_si256(m, a)
+#define V_OR(a, b)         _mm256_or_si256(a, b)
+#define V_XOR(a, b)        _mm256_xor_si256(a, b)
+#define V_EQ8(a, b)        _mm256_cmpeq_epi8(a, b)
+#define V_EQ16(a, b)       _mm256_cmpeq_epi16(a, b)
+#define V_SRL16(a, n)      _mm256_srli_epi16(a, n)
+#define V_MIN16U(a, b)     _mm256_min_epu16(a, b)
+#define V_BLEND(a, b, m)   _mm256_blendv_epi8(a, b, m)
+#define V_MOVEMASK8(a)     ((uint32_t)_mm256_movemask_epi8(a))
+//Two 16-bit masks to one byte mask, lanes in order
+#define V_NARROW(a, b)     _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8)
+//VEC_WORDS bytes at p widened to 16 bits, masks sign extended and values zero extended
+#define V_WIDEN_MASK(p)    _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(p)))
+#define V_WIDEN(p)         _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(p)))
+#elif LOCKSTEP_SIMD
+#include <emmintrin.h>
+typedef __m128i VEC;
+#define VEC_BYTES 16
+#define V_LOAD(p)          _mm_loadu_si128((const __m128i*)(p))
+#define V_STORE(p, v)      _mm_storeu_si128((__m128i*)(p), v)
+#define V_SET8(b)          _mm_set1_epi8((char)(b))
+#define V_SET16(w)         _mm_set1_epi16((short)(w))
+#define V_ZERO()           _mm_setzero_si128()
+#define V_ADD8(a, b)       _mm_add_epi8(a, b)
+#define V_SUB8(a, b)       _mm_sub_epi8(a, b)
+#define V_ADD16(a, b)      _mm_add_epi16(a, b)
+#define V_SUBS8U(a, b)     _mm_subs_epu8(a, b)
+#define V_SUBS16U(a, b)    _mm_subs_epu16(a, b)
+#define V_AND(a, b)        _mm_and_si128(a, b)
+#define V_ANDNOT(m, a)     _mm_andnot_si128(m, a)
+#define V_OR(a, b)         _mm_or_si128(a, b)
+#define V_XOR(a, b)        _mm_xor_si128(a, b)
+#define V_EQ8(a, b)        _mm_cmpeq_epi8(a, b)
+#define V_EQ16(a, b)       _mm_cmpeq_epi16(a, b)
+#define V_SRL16(a, n)      _mm_srli_epi16(a, n)
+//SSE2 only has the signed minimum, flipping the sign bits turns it into the unsigned one
+#define V_MIN16U(a, b)     _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(a, V_SET16(0x8000)), _mm_xor_si128(b, V_SET16(0x8000))), V_SET16(0x8000))
+#define V_BLEND(a, b, m)   _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a))
+#define V_MOVEMASK8(a)     ((uint32_t)_mm_movemask_epi8(a))
+#define V_NARROW(a, b)     _mm_packs_epi16(a, b)
+#define V_WIDEN_MASK(p)    _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p)), _mm_loadl_epi64((const __m128i*)(p)))
+#define V_WIDEN(p)         _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p)), _mm_setzero_si128())
+#endif
+
+#if LOCKSTEP_SIMD
+#define VEC_WORDS (VEC_BYTES / 2)
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline unsigned LowestBit(uint32_t bits) { unsigned long i; _BitScanForward(&i, bits); return (unsigned)i; }
+#else
+#define LowestBit(bits) ((unsigned)__builtin_ctz(bits))
+#endif
+#endif
+
+#if LOCKSTEP_SIMD && defined(__AVX2__)
+const char LOCKSTEP_INSTRUCTIONS[] = "avx2";
+#elif LOCKSTEP_SIMD
+const char LOCKSTEP_INSTRUCTIONS[] = "sse2";
+#else
+const char LOCKSTEP_INSTRUCTIONS[] = "scalar";
+#endif
+
+#define FETCH(c8, address) ((c8)->MEMORY[(address) & ADDRESS_MASK] << 8 | (c8)->MEMORY[((address) + 1) & ADDRESS_MASK])
+
+LOCKSTEP *CreateLockstep()
+{
+    return (LOCKSTEP*)calloc(1, sizeof(LOCKSTEP));
+}
+
+void DestroyLockstep(LOCKSTEP *ls)
+{
+    free(ls);
+}
+
+//Lane registers -> its CHIP8
+static void StoreLane(LOCKSTEP *ls, unsigned l)
+{
+    CHIP8 *c8 = &ls->machines[l];
+    unsigned r;
+    for(r=0; r < 0x10; r++)
+        c8->V[r] = ls->V[r][l];
+    c8->PC = ls->PC[l];
+    c8->I_REGISTER = ls->I[l];
+    c8->delay_timer = ls->delay_timer[l];
+    c8->sound_timer = ls->sound_timer[l];
+}
+
+//Its CHIP8 -> lane registers
+static void LoadLane(LOCKSTEP *ls, unsigned l)
+{
+    const CHIP8 *c8 = &ls->machines[l];
+    unsigned r;
+    for(r=0; r < 0x10; r++)
+        ls->V[r][l] = c8->V[r];
+    ls->PC[l] = c8->PC;
+    ls->I[l] = c8->I_REGISTER;
+    ls->delay_timer[l] = c8->delay_timer;
+    ls->sound_timer[l] = c8->sound_timer;
+}
+
+void InitLockstep(LOCKSTEP *ls, unsigned lanes, QUIRK_PROFILE quirks, const uint8_t *rom, size_t size, uint64_t seed)
+{
+    unsigned l;
+    if(lanes > LOCKSTEP_MAX_LANES)
+        lanes = LOCKSTEP_MAX_LANES;
+    ls->lanes = lanes;
+    ls->width = (lanes + LOCKSTEP_ALIGN - 1) / LOCKSTEP_ALIGN * LOCKSTEP_ALIGN;
+    ls->running = lanes;
+    ls->profile = (uint8_t)quirks;
+    ls->quirks = QUIRK_FLAGS[quirks];
+    memset(ls->written, 0, sizeof(ls->written));
+    for(l=0; l < ls->width; l++)
+    {
+        CHIP8 *c8 = &ls->machines[l];
+        InitChip8(c8);
+        SeedChip8(c8, seed);
+        SetQuirkProfile(c8, quirks);
+        LoadGameFromBuffer(c8, rom, size);
+        LoadLane(ls, l);
+        ls->status[l] = l < lanes ? LANE_RUNNING : LANE_UNUSED;
+        ls->remaining[l] = 0;
+        ls->executed[l] = 0;
+    }
+}
+
+void FlushLockstep(LOCKSTEP *ls)
+{
+    unsigned l;
+    for(l=0; l < ls->lanes; l++)
+        StoreLane(ls, l);
+}
+
+//Select the next lanes to run: the lowest PC among the lanes with instructions left and every lane at it.
+//Returns false once no lane has any left
+static bool NextGroup(LOCKSTEP *ls, uint16_t *pc)
+{
+    unsigned l;
+    uint16_t low = 0xFFFF;
+#if LOCKSTEP_SIMD
+    //Lanes without instructions left count as 0xFFFF
+    uint16_t lows[VEC_WORDS];
+    VEC m = V_SET16(0xFFFF);
+    for(l=0; l < ls->width; l += VEC_WORDS)
+        m = V_MIN16U(m, V_OR(V_LOAD(&ls->PC[l]), V_EQ16(V_LOAD(&ls->remaining[l]), V_ZERO())));
+    V_STORE(lows, m);
+    for(l=0; l < VEC_WORDS; l++)
+        low = lows[l] < low ? lows[l] : low;
+#else
+    for(l=0; l < ls->width; l++)
+        if(ls->remaining[l] && ls->PC[l] < low)
+            low = ls->PC[l];
+#endif
+    if(low == 0xFFFF)
+    {
+        //Either every lane is done or some really are at 0xFFFF
+        for(l=0; l < ls->width && !ls->remaining[l]; l++);
+        if(l == ls->width)
+            return false;
+    }
+#if LOCKSTEP_SIMD
+    VEC target = V_SET16(low);
+    for(l=0; l < ls->width; l += VEC_BYTES)
+    {
+        VEC a = V_AND(V_EQ16(V_LOAD(&ls->PC[l]), target), V_XOR(V_EQ16(V_LOAD(&ls->remaining[l]), V_ZERO()), V_SET16(0xFFFF)));
+        VEC b = V_AND(V_EQ16(V_LOAD(&ls->PC[l + VEC_WORDS]), target), V_XOR(V_EQ16(V_LOAD(&ls->remaining[l + VEC_WORDS]), V_ZERO()), V_SET16(0xFFFF)));
+        V_STORE(&ls->mask[l], V_NARROW(a, b));
+    }
+#else
+    for(l=0; l < ls->width; l++)
+        ls->mask[l] = (ls->PC[l] == low && ls->remaining[l]) ? 0xFF : 0;
+#endif
+    *pc = low;
+    return true;
+}
+
+//Indices of the selected lanes, returns how many
+static unsigned SelectedLanes(const LOCKSTEP *ls, uint16_t *lanes)
+{
+    unsigned n = 0, l;
+#if LOCKSTEP_SIMD
+    for(l=0; l < ls->width; l += VEC_BYTES)
+    {
+        uint32_t bits = V_MOVEMASK8(V_LOAD(&ls->mask[l]));
+        while(bits)
+        {
+            lanes[n++] = (uint16_t)(l + LowestBit(bits));
+            bits &= bits - 1;
+        }
+    }
+#else
+    for(l=0; l < ls->width; l++)
+        if(ls->mask[l])
+            lanes[n++] = (uint16_t)l;
+#endif
+    return n;
+}
+
+//Retire the instruction on `lane`, stopping it for good when it failed or waits for a key
+static void RetireLane(LOCKSTEP *ls, unsigned lane, bool ok)
+{
+    if(!ok)
+    {
+        //RunFrame() doesn't count the failed instruction
+        ls->executed[lane] -= ls->remaining[lane];
+        ls->status[lane] = LANE_FAILED;
+    }
+    else
+    {
+        ls->remaining[lane]--;
+        if(!ls->machines[lane].WAIT_KEY)
+            return;
+        ls->executed[lane] -= ls->remaining[lane];
+        ls->status[lane] = LANE_WAITING;
+    }
+    ls->remaining[lane] = 0;
+    ls->running--;
+}
+
+//Run the instruction one selected lane at a time through its handler, all of them share its opcode
+static void RunLanes(LOCKSTEP *ls, const uint16_t *lanes, unsigned n, uint8_t o, OPERANDS op)
+{
+    uint32_t instruction = o == UNKNOWN_INSTRUCTION ? 0 : INSTRUCTION_SET[o].opcode;
+    INSTRUCTION_FUNC handler = o == UNKNOWN_INSTRUCTION ? NULL : INSTRUCTION_SETS[ls->profile][o].func_ptr;
+    //Only 0xF033 and 0xF055 store
+    uint16_t length = instruction == 0xF033 ? 3 : instruction == 0xF055 ? op.X + 1 : 0;
+    unsigned i;
+    for(i=0; i < n; i++)
+    {
+        unsigned l = lanes[i];
+        CHIP8 *c8 = &ls->machines[l];
+        uint16_t pc = ls->PC[l], start = ls->I[l], k;
+        if(handler == NULL)
+        {
+            //Execute() reports it the same way RunFrame() does
+            StoreLane(ls, l);
+            RetireLane(ls, l, Execute(c8));
+            LoadLane(ls, l);
+            continue;
+        }
+        //Calls and returns only need PC, the stack lives in the machine already
+        if(instruction == 0x2000)
+        {
+            c8->STACK[c8->SP++ & 0xF] = (uint16_t)(pc + 2);
+            ls->PC[l] = op.NNN;
+        }
+        else if(instruction == 0x00EE)
+            ls->PC[l] = c8->STACK[--c8->SP & 0xF];
+        //Sprites only read Vx, Vy and I and only write VF
+        else if(instruction == 0xD000)
+        {
+            c8->V[op.X] = ls->V[op.X][l];
+            c8->V[op.Y] = ls->V[op.Y][l];
+            c8->I_REGISTER = ls->I[l];
+            c8->operands = op.packed;
+            handler(c8);
+            ls->V[0xF][l] = c8->V[0xF];
+            ls->PC[l] = (uint16_t)(pc + 2);
+        }
+        else
+        {
+            StoreLane(ls, l);
+            c8->operands = op.packed;
+            c8->PC += 2;
+            handler(c8);
+            LoadLane(ls, l);
+        }
+        for(k=0; k < length; k++)
+            ls->written[(start + k) & ADDRESS_MASK] = 1;
+        RetireLane(ls, l, true);
+    }
+    ls->scalar_instructions += n;
+}
+
+#if LOCKSTEP_SIMD
+//Vx of every selected lane = f(Vx, Vy), keeping the other lanes
+#define BYTE_KERNEL(expr) for(l=0; l < ls->width; l += VEC_BYTES)\
+{\
+    VEC m = V_LOAD(&ls->mask[l]);\
+    VEC vx = V_LOAD(&ls->V[x][l]);\
+    VEC vy = V_LOAD(&ls->V[y][l]);\
+    (void)vy;\
+    V_STORE(&ls->V[x][l], V_BLEND(vx, (expr), m));\
+}
+//The handlers write VF before Vx and read Vx and Vy again after it, so x or y = 0xF see the flag
+#define FLAG_KERNEL(flag, expr) for(l=0; l < ls->width; l += VEC_BYTES)\
+{\
+    VEC m = V_LOAD(&ls->mask[l]);\
+    VEC vx = V_LOAD(&ls->V[x][l]);\
+    VEC vy = V_LOAD(&ls->V[y][l]);\
+    VEC vs = V_LOAD(&ls->V[shift][l]);\
+    (void)vs;\
+    V_STORE(&ls->V[0xF][l], V_BLEND(V_LOAD(&ls->V[0xF][l]), V_AND((flag), one), m));\
+    vx = V_LOAD(&ls->V[x][l]);\
+    vy = V_LOAD(&ls->V[y][l]);\
+    vs = V_LOAD(&ls->V[shift][l]);\
+    (void)vy;\
+    V_STORE(&ls->V[x][l], V_BLEND(vx, (expr), m));\
+}
+//A skip condition of every selected lane into ls->flag
+#define SKIP_KERNEL(expr) for(l=0; l < ls->width; l += VEC_BYTES)\
+{\
+    VEC vx = V_LOAD(&ls->V[x][l]);\
+    VEC vy = V_LOAD(&ls->V[y][l]);\
+    (void)vy;\
+    V_STORE(&ls->flag[l], (expr));\
+}
+
+//Run the instruction on every selected lane with vector code, retiring it. Returns false, leaving every lane as
+//it was, for the instructions that have to go through their handlers
+static bool RunVector(LOCKSTEP *ls, uint32_t instruction, OPERANDS op, uint16_t pc)
+{
+    const VEC one = V_SET8(1), ones = V_SET8(0xFF);
+    unsigned x = op.X, y = op.Y, l;
+    unsigned shift = (ls->quirks & QUIRK_SHIFT_VY) ? y : x;
+    uint16_t next = (uint16_t)(pc + 2);
+    bool skip = false;
+    switch(instruction)
+    {
+    case 0x6000: BYTE_KERNEL(V_SET8(op.KK)); break;
+    case 0x7000: BYTE_KERNEL(V_ADD8(vx, V_SET8(op.KK))); break;
+    case 0x8000: BYTE_KERNEL(vy); break;
+    case 0x8001: BYTE_KERNEL(V_OR(vx, vy)); break;
+    case 0x8002: BYTE_KERNEL(V_AND(vx, vy)); break;
+    case 0x8003: BYTE_KERNEL(V_XOR(vx, vy)); break;
+    //Carry when vx > 255 - vy, borrow flags when the difference saturates to 0
+    case 0x8004: FLAG_KERNEL(V_XOR(V_EQ8(V_SUBS8U(vx, V_XOR(vy, ones)), V_ZERO()), ones), V_ADD8(vx, vy)); break;
+    case 0x8005: FLAG_KERNEL(V_XOR(V_EQ8(V_SUBS8U(vx, vy), V_ZERO()), ones), V_SUB8(vx, vy)); break;
+    case 0x8007: FLAG_KERNEL(V_XOR(V_EQ8(V_SUBS8U(vy, vx), V_ZERO()), ones), V_SUB8(vy, vx)); break;
+    //There is no byte shift, the bits crossing into the next byte are masked off
+    case 0x8006: FLAG_KERNEL(vs, V_AND(V_SRL16(vs, 1), V_SET8(0x7F))); break;
+    case 0x800E: FLAG_KERNEL(V_SRL16(vs, 7), V_ADD8(vs, vs)); break;
+    case 0xF007:
+        for(l=0; l < ls->width; l += VEC_BYTES)
+            V_STORE(&ls->V[x][l], V_BLEND(V_LOAD(&ls->V[x][l]), V_LOAD(&ls->delay_timer[l]), V_LOAD(&ls->mask[l])));
+        break;
+    case 0xF015:
+        for(l=0; l < ls->width; l += VEC_BYTES)
+            V_STORE(&ls->delay_timer[l], V_BLEND(V_LOAD(&ls->delay_timer[l]), V_LOAD(&ls->V[x][l]), V_LOAD(&ls->mask[l])));
+        break;
+    case 0xF018:
+        for(l=0; l < ls->width; l += VEC_BYTES)
+            V_STORE(&ls->sound_timer[l], V_BLEND(V_LOAD(&ls->sound_timer[l]), V_LOAD(&ls->V[x][l]), V_LOAD(&ls->mask[l])));
+        break;
+    case 0x3000: SKIP_KERNEL(V_EQ8(vx, V_SET8(op.KK))); skip = true; break;
+    case 0x4000: SKIP_KERNEL(V_XOR(V_EQ8(vx, V_SET8(op.KK)), ones)); skip = true; break;
+    case 0x5000: SKIP_KERNEL(V_EQ8(vx, vy)); skip = true; break;
+    case 0x9000: SKIP_KERNEL(V_XOR(V_EQ8(vx, vy), ones)); skip = true; break;
+    case 0xA000: case 0x1000:
+        break;
+    case 0xF01E:
+        //VF = I + Vx > 0xFFF, then I += Vx, which reads the new VF when x = 0xF
+        if(x == 0xF)
+            return false;
+        for(l=0; l < ls->width; l += VEC_WORDS)
+            V_STORE(&ls->flag16[l], V_XOR(V_EQ16(V_SUBS16U(V_LOAD(&ls->I[l]), V_SUBS16U(V_SET16(0xFFF), V_WIDEN(&ls->V[x][l]))), V_ZERO()), V_SET16(0xFFFF)));
+        for(l=0; l < ls->width; l += VEC_BYTES)
+        {
+            VEC flag = V_AND(V_NARROW(V_LOAD(&ls->flag16[l]), V_LOAD(&ls->flag16[l + VEC_WORDS])), one);
+            V_STORE(&ls->V[0xF][l], V_BLEND(V_LOAD(&ls->V[0xF][l]), flag, V_LOAD(&ls->mask[l])));
+        }
+        break;
+    default:
+        return false;
+    }
+    //VF reset of the logic instructions
+    if((ls->quirks & QUIRK_VF_RESET) && (instruction == 0x8001 || instruction == 0x8002 || instruction == 0x8003))
+        for(l=0; l < ls->width; l += VEC_BYTES)
+            V_STORE(&ls->V[0xF][l], V_ANDNOT(V_LOAD(&ls->mask[l]), V_LOAD(&ls->V[0xF][l])));
+
+    //16-bit registers: PC, I and the budget
+    VEC target = V_SET16(instruction == 0x1000 ? op.NNN : next);
+    for(l=0; l < ls->width; l += VEC_WORDS)
+    {
+        VEC m = V_WIDEN_MASK(&ls->mask[l]);
+        VEC to = skip ? V_ADD16(target, V_AND(V_WIDEN_MASK(&ls->flag[l]), V_SET16(2))) : target;
+        V_STORE(&ls->PC[l], V_BLEND(V_LOAD(&ls->PC[l]), to, m));
+        if(instruction == 0xA000)
+            V_STORE(&ls->I[l], V_BLEND(V_LOAD(&ls->I[l]), V_SET16(op.NNN), m));
+        else if(instruction == 0xF01E)
+            V_STORE(&ls->I[l], V_ADD16(V_LOAD(&ls->I[l]), V_AND(V_WIDEN(&ls->V[x][l]), m)));
+        V_STORE(&ls->remaining[l], V_ADD16(V_LOAD(&ls->remaining[l]), m));
+    }
+    return true;
+}
+#endif
+
+//Run every selected lane until each has used its budget or stopped
+static void RunSlice(LOCKSTEP *ls)
+{
+    uint16_t lanes[LOCKSTEP_MAX_LANES];
+    uint16_t pc;
+    while(NextGroup(ls, &pc))
+    {
+        unsigned n = SelectedLanes(ls, lanes), i, kept = 0;
+        uint16_t opcode = FETCH(&ls->machines[lanes[0]], pc);
+        //A lane may have stored over this code: the lanes holding something else than the first one wait for a
+        //later step, they are still at the lowest PC
+        if(ls->written[pc & ADDRESS_MASK] || ls->written[(pc + 1) & ADDRESS_MASK])
+        {
+            for(i=0; i < n; i++)
+            {
+                if(FETCH(&ls->machines[lanes[i]], pc) == opcode)
+                    lanes[kept++] = lanes[i];
+                else
+                    ls->mask[lanes[i]] = 0;
+            }
+            n = kept;
+        }
+        ls->steps++;
+        uint8_t o = DECODE_TABLE[opcode];
+        uint32_t instruction = o == UNKNOWN_INSTRUCTION ? 0 : INSTRUCTION_SET[o].opcode;
+        OPERANDS op = DecodeOperands(opcode);
+        bool vectorized = false;
+#if LOCKSTEP_SIMD
+        vectorized = o != UNKNOWN_INSTRUCTION && RunVector(ls, instruction, op, pc);
+        if(vectorized)
+            ls->vector_instructions += n;
+#endif
+        if(!vectorized)
+            RunLanes(ls, lanes, n, o, op);
+        //Idle loops are closed by short jumps back, each lane skips its own like RunFrame() does. Of the vector
+        //instructions only 0x1000 moves PC back
+        if(vectorized && !(instruction == 0x1000 && MAY_CLOSE_IDLE_LOOP(pc, op.NNN)))
+            continue;
+        for(i=0; i < n; i++)
+        {
+            unsigned l = lanes[i];
+            if(!ls->remaining[l] || !MAY_CLOSE_IDLE_LOOP(pc, ls->PC[l]))
+                continue;
+            StoreLane(ls, l);
+            uint32_t skipped = SkipIdleLoop(&ls->machines[l], ls->remaining[l]);
+            if(skipped)
+            {
+                LoadLane(ls, l);
+                ls->remaining[l] -= (uint16_t)skipped;
+            }
+        }
+    }
+}
+
+void RunLockstep(LOCKSTEP *ls, uint32_t budget)
+{
+    unsigned l;
+    //Slices fit the 16-bit budget of the lanes
+    while(budget && ls->running)
+    {
+        uint16_t slice = budget > 0xFFFF ? 0xFFFF : (uint16_t)budget;
+        for(l=0; l < ls->width; l++)
+        {
+            ls->remaining[l] = ls->status[l] == LANE_RUNNING ? slice : 0;
+            if(ls->remaining[l])
+                ls->executed[l] += slice;
+        }
+        RunSlice(ls);
+        budget -= slice;
+    }
+}
+
+void TickLockstepTimers(LOCKSTEP *ls)
+{
+    unsigned l;
+#if LOCKSTEP_SIMD
+    for(l=0; l < ls->width; l += VEC_BYTES)
+    {
+        VEC tick = V_AND(V_EQ8(V_LOAD(&ls->status[l]), V_SET8(LANE_RUNNING)), V_SET8(1));
+        V_STORE(&ls->delay_timer[l], V_SUBS8U(V_LOAD(&ls->delay_timer[l]), tick));
+        V_STORE(&ls->sound_timer[l], V_SUBS8U(V_LOAD(&ls->sound_timer[l]), tick));
+    }
+#else
+    for(l=0; l < ls->width; l++)
+    {
+        if(ls->status[l] != LANE_RUNNING)
+            continue;
+        if(ls->delay_timer[l] > 0)
+            ls->delay_timer[l]--;
+        if(ls->sound_timer[l] > 0)
+            ls->sound_timer[l]--;
+    }
+#endif
+}
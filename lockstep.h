@@ -0,0 +1,69 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "chip8.h"
+
+//Lockstep batch engine: up to LOCKSTEP_MAX_LANES machines ("lanes") running the same rom with different input, their
+//registers stored as arrays with one element per lane. Every step picks the lowest PC any lane with budget left is at
+//and runs that instruction on all the lanes there at once. Register loads and arithmetic, 0xA000, jumps, register
+//skips, timer moves and 0xF01E run as SSE2 (AVX2 when built with it) vector code under a lane mask, everything
+//else runs its handler one lane at a time, the lane's registers moved in and out of its CHIP8. Memory, stack, display
+//and keypad stay in the CHIP8 of each lane: the instructions that use them address them per lane anyway.
+//Lanes leave a frame in exactly the state RunFrame() leaves a single machine in.
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(CHIP8_NO_SIMD)
+#define LOCKSTEP_SIMD 1
+#else
+#define LOCKSTEP_SIMD 0
+#endif
+
+//"avx2", "sse2" or "scalar", the instructions lockstep.c was built for
+extern const char LOCKSTEP_INSTRUCTIONS[];
+
+#define LOCKSTEP_MAX_LANES 256
+#define LOCKSTEP_ALIGN 32//lanes are allocated in multiples of the widest vector, in bytes
+
+typedef enum {LANE_RUNNING, LANE_WAITING, LANE_FAILED, LANE_UNUSED} LANE_STATUS;
+
+typedef struct {
+    unsigned lanes;//lanes in use
+    unsigned width;//`lanes` rounded up to LOCKSTEP_ALIGN, the lanes past `lanes` stay LANE_UNUSED
+    unsigned running;//lanes still LANE_RUNNING
+    uint8_t profile;//QUIRK_PROFILE of the rom, picks the handlers
+    uint8_t quirks;//its QUIRK_FLAGS
+    //Registers, element l belongs to lane l
+    uint8_t V[0x10][LOCKSTEP_MAX_LANES];
+    uint16_t PC[LOCKSTEP_MAX_LANES];
+    uint16_t I[LOCKSTEP_MAX_LANES];
+    uint8_t delay_timer[LOCKSTEP_MAX_LANES];
+    uint8_t sound_timer[LOCKSTEP_MAX_LANES];
+    uint8_t status[LOCKSTEP_MAX_LANES];//LANE_STATUS
+    uint16_t remaining[LOCKSTEP_MAX_LANES];//instructions left in the current slice of the frame, 0 once stopped
+    uint64_t executed[LOCKSTEP_MAX_LANES];//instructions retired, idle loops skipped included
+    //Scratch of the current step
+    uint8_t mask[LOCKSTEP_MAX_LANES];//0xFF for the lanes running it
+    uint8_t flag[LOCKSTEP_MAX_LANES];
+    uint16_t flag16[LOCKSTEP_MAX_LANES];
+    uint8_t written[0x1000];//some lane stored here, so the code at it may differ between lanes
+    //Everything else of every lane: memory, stack, display, keypad and random generator
+    CHIP8 machines[LOCKSTEP_MAX_LANES];
+    //Statistics
+    uint64_t steps;//instructions issued, each to every lane at its PC
+    uint64_t vector_instructions;//lane instructions run by vector code
+    uint64_t scalar_instructions;//lane instructions run one lane at a time
+} LOCKSTEP;
+
+LOCKSTEP *CreateLockstep();
+void DestroyLockstep(LOCKSTEP *ls);
+//Power on `lanes` machines with the same rom and seed, statistics are kept. Set the keypad of lane l in
+//ls->machines[l].KEY before running
+void InitLockstep(LOCKSTEP *ls, unsigned lanes, QUIRK_PROFILE quirks, const uint8_t *rom, size_t size, uint64_t seed);
+//Run `budget` instructions on every running lane, like RunFrame() does on one machine. A lane that waits for a key
+//or hits an unknown opcode stops there for good
+void RunLockstep(LOCKSTEP *ls, uint32_t budget);
+//TickTimers() of every running lane
+void TickLockstepTimers(LOCKSTEP *ls);
+//Copy the registers of every lane into ls->machines, so each holds its whole machine
+void FlushLockstep(LOCKSTEP *ls);
+
+#endif
@@ -3,487 +3,665 @@
 #include <time.h>
 #include <stdint.h>
 #include <string.h>
-#include <math.h>
 //SDL2
-#include <SDL2\SDL.h>
-#include <SDL2\SDL_audio.h>
-
-//DEBUG PRINT
-#ifdef _DEBUG
-#define p(...) printf(__VA_ARGS__);
-#else
-#define p(...)
-#endif
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_audio.h>
+
+#include "chip8.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "audio.h"
+#include "savestate.h"
+#include "profiler.h"
+#include "replay.h"
+#include "quirks.h"
+#include "triplebuffer.h"
+
+CHIP8 chip8;//The machine shown in the window, owned by the emulation thread in threaded mode
+
+BEEPER beeper;//Fed by the frame loop, drained by the audio callback
+
+void populate_audio(void* data, Uint8 *stream, int len) {
+    RenderBeeper((BEEPER*)data, stream, (unsigned)len);
+}
+
+#define FULL_UPLOAD_BYTES(hires) ((hires) ? DISPLAY_WIDTH * DISPLAY_HEIGHT * 4 : LORES_WIDTH * LORES_HEIGHT * 4)
+
+//Copy every run of consecutive dirty rows of `display` into the texture with one SDL_UpdateTexture call, returns the
+//bytes uploaded. The texture has the size of the mode
+uint64_t UploadDirtyRows(SDL_Texture *texture, const uint64_t (*display)[DISPLAY_ROW_WORDS], bool hires, uint64_t dirty)
+{
+    static uint32_t texels[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+    unsigned width = hires ? DISPLAY_WIDTH : LORES_WIDTH;
+    unsigned height = hires ? DISPLAY_HEIGHT : LORES_HEIGHT;
+    uint64_t uploaded = 0;
+    unsigned y = 0, k;
+    while(y < height)
+    {
+        if(!((dirty >> y) & 0x1)) { y++; continue; }
+        unsigned first = y;
+        for(; y < height && ((dirty >> y) & 0x1); y++)
+        {
+            //Expand the packed row words, one 32-bit texel per pixel
+            for(k=0; k < width; k++)
+                texels[y][k] = (display[y][k >> 6] >> (63 - (k & 63))) & 0x1 ? 0xFFFFFF : 0;
+        }
+        SDL_Rect rect = {0, (int)first, (int)width, (int)(y - first)};
+        SDL_UpdateTexture(texture, &rect, texels[first], DISPLAY_WIDTH * 4);
+        uploaded += (uint64_t)(y - first) * width * 4;
+    }
+    return uploaded;
+}
+
+//Black streaming texture of `width` x `height`, SDL_RenderCopy scales it to the window
+SDL_Texture *CreateDisplayTexture(SDL_Renderer *renderer, int width, int height)
+{
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    unsigned char* pixels = NULL;    int pitch = 0;
+    if(texture == NULL || SDL_LockTexture(texture, NULL, (void**)&pixels, &pitch ) < 0) {
+        SDL_ShowSimpleMessageBox(0, "SDL failed to access texture", SDL_GetError(), NULL); 
+        exit(-12);
+    }
+    memset(pixels, 0, pitch*height);//Fill black texture
+    SDL_UnlockTexture(texture);
+    return texture;
+}
 
-#define true 1
-#define false 0
-#define bool int
-
-//Super Chip-48, an interpreter for the HP48 calculator, added a 128x64-pixel mode. This mode is now supported by most of the interpreters on other platforms.
-#define DISPLAY_WIDTH 64
-#define DISPLAY_HEIGHT 32
-#define MEMORY_SIZE sizeof(uint8_t) * 0xFFF
-#define V_REGISTER_SIZE sizeof(uint8_t) * 0x10
-#define STACK_SIZE sizeof(uint16_t) * 0x10
-#define KEY_SIZE sizeof(uint8_t) * 0x10
-#define DISPLAY_SIZE sizeof(uint8_t) * DISPLAY_WIDTH * DISPLAY_HEIGHT
-#define MAX_GAME_SIZE (0x1000 - 0x200)
-
-//CHIP8 INTERNAL MEMORY RAPPRESENTATION
-uint8_t MEMORY[0xFFF];//Main chip8 memory
-uint8_t V[0x10];//16 general purpose 8-bit registers, usually referred to as Vx, where x is a hexadecimal digit (0 through F)
-uint16_t I_REGISTER;//This is a 16-bit register called I. This register is generally used to store memory addresses, so only the lowest (rightmost) 12 bits are usually used.
-uint16_t PC;//The program counter is used to store the currently executing address
-uint16_t STACK[0x10];//The stack is an array of 16 16-bit values, used to store the address that the interpreter shoud return to when finished with a subroutine. Chip-8 allows for up to 16 levels of nested subroutines.
-uint8_t SP;//The stack pointer it is used to point to the topmost level of the stack
-uint8_t KEY[0x10];
-uint8_t delay_timer;
-uint8_t sound_timer;
-uint8_t DISPLAY[DISPLAY_WIDTH][DISPLAY_HEIGHT];
-uint16_t OPCODE;
-uint8_t X;//A 4-bit value, the lower 4 bits of the high byte of the instruction
-uint8_t Y;//A 4-bit value, the upper 4 bits of the low byte of the instruction
-uint16_t NNN;//A 12-bit value, the lowest 12 bits of the instruction
-uint8_t  KK;//lowest 8 bits
-uint8_t  N;//lowest 4 bits
-//Some flags
-bool draw_flag;//update screen when is true
-bool WAIT_KEY = false;//stall emulation and wait for a key press when is true
-
-#define FONTSET_ADDRESS 0x00
-#define FONTSET_BYTES_PER_CHAR 5
-
-uint8_t chip8_fontset[80] = 
-{ 
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F 
-};
-
-void LoadGame(char *filename) {
-    FILE * file = fopen(filename, "rb");
-    if (NULL == file) {
-        SDL_ShowSimpleMessageBox(0, "Unable to open rom", filename, NULL);
-        exit(42);
+//The window side: the streaming texture, created again only when the mode changes, and upload statistics
+typedef struct {
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    bool hires;
+    PROFILE *profile;//upload and present timings, or NULL
+    uint64_t upload_bytes_saved;
+    uint64_t rendered_frames;
+    uint64_t presented_frames;
+} SCREEN;
+
+//Upload the `dirty` rows of `display` and present, nothing happens if no row changed unless the window needs a repaint.
+//A mode switch recreates the texture at the size of the new mode, and every row goes into it. Only calls with a
+//`new_frame` to show count in the upload statistics, wakeups for input or timeouts have no frame to save bytes on
+void PresentDisplay(SCREEN *screen, const uint64_t (*display)[DISPLAY_ROW_WORDS], bool hires, uint64_t dirty, bool repaint, bool new_frame)
+{
+    if(hires != screen->hires)
+    {
+        SDL_DestroyTexture(screen->texture);
+        screen->texture = hires ? CreateDisplayTexture(screen->renderer, DISPLAY_WIDTH, DISPLAY_HEIGHT)
+                                : CreateDisplayTexture(screen->renderer, LORES_WIDTH, LORES_HEIGHT);
+        screen->hires = hires;
+        dirty = ALL_ROWS_DIRTY;
+    }
+    if(new_frame)
+        screen->rendered_frames++;
+    if(!dirty && !repaint)
+    {
+        if(new_frame)
+            screen->upload_bytes_saved += FULL_UPLOAD_BYTES(hires);
+        return;
     }
-    fread(&MEMORY[0x200], 1, MAX_GAME_SIZE, file);
-    fclose(file);
-};
-
-
-
-typedef struct {uint32_t opcode; bool hasVariant; void(*func_ptr)();}INSTRUCTION_REF;
-#define INSTRUCTIONS_COUNT 36
-#define BIND_INSTRUCTION(o, hasvariant) {(uint32_t)o, hasvariant, chip8_func_##o}
-#define CREATE_INSTRUCTION(o, code) void chip8_func_##o () code;                                       
-//Implement instruction functions                   
-CREATE_INSTRUCTION(0x00E0, {memset(DISPLAY, 0, DISPLAY_SIZE);draw_flag = true;          p("Clear screen\n");    })//clear 
-CREATE_INSTRUCTION(0x00EE, {PC = STACK[--SP];                                           p("Return from subroutine PC(%i) = STACK[(%i)]; SP-1(%i)\n", PC, SP, SP);   })//return from subroutine (PC to address on top of the stack, then subtract 1 from the SP)
-CREATE_INSTRUCTION(0x1000, {PC = NNN;                                                   p("Jump to nnn PC = %i\n", NNN);    })//jmp to nnn (set PC to nnn)
-CREATE_INSTRUCTION(0x2000, {STACK[SP++] = PC;  PC = NNN;                                p("Call subroutine: SP+1(%i);STACK[%i]; PC(%i) = nnn(%i)\n", SP, SP, PC, NNN);  })//call subroutine from nnn (increment the SP, then puts the current PC on top of the stack. PC is set to nnn)
-CREATE_INSTRUCTION(0x3000, {if(V[X] == KK) PC+=2;                                       p("Skip next instr if %i == %i\n", V[X], KK);       })//skip next instruction if(Vx == KK) PC+=2
-CREATE_INSTRUCTION(0x4000, {if(V[X] != KK) PC+=2;                                       p("Skip next instr if %i != %i\n", V[X], KK);       })//skip next instruction if(Vx != KK) PC+=2
-CREATE_INSTRUCTION(0x5000, {if(V[X] == V[Y]) PC+=2;                                     p("Skip next instr if %i == %i\n", V[X], V[Y]);     })//skip next instruction if(Vx == Vy) PC+=2
-CREATE_INSTRUCTION(0x6000, {V[X] = KK;                                                  p("assign V[%i] = %i\n", X, KK);      })//Vx = KK
-CREATE_INSTRUCTION(0x7000, {V[X] += KK;                                                 p("add V[%i] += %i\n", X, KK);      })//Vx += KK
-//Aritmethic functions
-CREATE_INSTRUCTION(0x8000, {V[X] = V[Y];                                                p("V[%i] = V[%i]\n", X, Y);     })//Vx = Vy
-CREATE_INSTRUCTION(0x8001, {V[X] = V[X] | V[Y];                                         p("assign V[%i] = V[%i] OR V[%i]\n", X, X, Y);     })//Vx = Vx OR Vy
-CREATE_INSTRUCTION(0x8002, {V[X] = V[X] & V[Y];                                         p("assign V[%i] = V[%i] AND V[%i]\n", X, X, Y);    })//Vx = Vx AND Vy
-CREATE_INSTRUCTION(0x8003, {V[X] = V[X] ^ V[Y];                                         p("assign V[%i] = V[%i] XOR V[%i]\n", X, X, Y);    })//Vx = Vx XOR Vy
-CREATE_INSTRUCTION(0x8004, {V[0xF] = ((int)V[X] + (int)V[Y] > 255)?1:0;V[X]=V[X]+V[Y];  p("add V[%i] += V[%i]\n", X, Y);   })//Vx += Vy set VF = carry -  If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.
-CREATE_INSTRUCTION(0x8005, {V[0xF] = (V[X] > V[Y]) ? 1 : 0; V[X]=V[X]-V[Y];             p("sub V[%i] -= V[%i]\n", X, Y);    })//Vx -= Vy set VF = NOT borrow - If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
-CREATE_INSTRUCTION(0x8006, {V[0xF] = V[X] & 0x1; V[X] = (V[X] >> 1);                    p("shr V[%i]>>1\n", X);     })//Vx >> 1 - If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
-CREATE_INSTRUCTION(0x8007, {V[0xF] = (V[Y] > V[X]) ? 1 : 0; V[X] = V[Y] - V[X];         p("sub V[%i] = V[%i] - V[%i]\n", X, Y, X);  })//Vx = Vy - Vx - set VF = NOT borrow - If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
-CREATE_INSTRUCTION(0x800E, {V[0xF] = (V[X] >> 7) & 0x1; V[X] = (V[X] << 1);             p("shl V[%i]<<1\n", X);     })//Vx << 1 - If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
-//Misc functions
-CREATE_INSTRUCTION(0x9000, {if(V[X] != V[Y]) PC+=2;                                     p("Skip next instr if %i != %i\n", V[X], V[Y]);     })//skip next instruction if(Vx != Vy) PC+=2
-CREATE_INSTRUCTION(0xA000, {I_REGISTER = NNN;                                           p("assign I = %i\n", NNN);     })//register I set to NNN
-CREATE_INSTRUCTION(0xB000, {PC = NNN + V[0];                                            p("Jump to %i\n", PC);        })//jmp to location nnn+V0 - PC+=nnn+V[0] - The program counter is set to nnn plus the value of V0
-CREATE_INSTRUCTION(0xC000, {V[X] = (rand() % 256) & KK;                                 p("random byte AND kk assign V[%i] = %i\n", X, V[X]);      })//Vx = random byte AND kk - generates a random number from 0 to 255, which is then ANDed with the value kk. The value is stored in Vx
-CREATE_INSTRUCTION(0xD000, {
-//Set collision flag to 0
-V[0xF] = 0;
-unsigned row = V[X];
-unsigned col = V[Y];
-unsigned byteI;
-unsigned bitI;
-for(byteI=0; byteI < N; byteI++)
+    PROFILE_BEGIN(upload_start);
+    uint64_t uploaded = UploadDirtyRows(screen->texture, display, hires, dirty);
+    PROFILE_END(screen->profile, PROFILE_UPLOAD, upload_start);
+    if(new_frame)
+        screen->upload_bytes_saved += FULL_UPLOAD_BYTES(hires) - uploaded;
+
+    PROFILE_BEGIN(present_start);
+    SDL_RenderClear(screen->renderer);
+    SDL_RenderCopy(screen->renderer, screen->texture, NULL, NULL);
+    SDL_RenderPresent(screen->renderer);
+    PROFILE_END(screen->profile, PROFILE_PRESENT, present_start);
+    screen->presented_frames++;
+}
+
+//CHIP-8 keypad, in key order
+static const SDL_Scancode KEYPAD[0x10] = {
+    SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
+    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
+    SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
+    SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V};
+
+//Input the window samples for the emulation: the keypad in the low 16 bits, the held hotkeys above
+#define INPUT_SAVE   (1u << 16)//F5
+#define INPUT_LOAD   (1u << 17)//F9
+#define INPUT_REWIND (1u << 18)//Backspace
+#define INPUT_TURBO  (1u << 19)//Tab
+#define NO_KEY -1
+
+uint32_t SampleInput()
 {
-    //Read n bytes from memory address at register I
-    uint8_t byte = MEMORY[I_REGISTER + byteI];
-    //Blit every bit of the byte to the screen
-    for(bitI=0; bitI < 8; bitI++)
+    const uint8_t *key = SDL_GetKeyboardState(NULL);
+    uint32_t input = 0;
+    unsigned k;
+    for(k=0; k < 0x10; k++)
+        if(key[KEYPAD[k]]) input |= 1u << k;
+    if(key[SDL_SCANCODE_F5]) input |= INPUT_SAVE;
+    if(key[SDL_SCANCODE_F9]) input |= INPUT_LOAD;
+    if(key[SDL_SCANCODE_BACKSPACE]) input |= INPUT_REWIND;
+    if(key[SDL_SCANCODE_TAB]) input |= INPUT_TURBO;
+    return input;
+}
+
+//Returns false on quit. Sets `repaint` when the window needs the last frame again and `pressed` to the first keypad
+//key that went down, for 0xF00A
+bool HandleEvent(const SDL_Event *e, bool *repaint, int *pressed)
+{
+    unsigned k;
+    if(e->type == SDL_QUIT)
+        return false;
+    //Window uncovered, resized... the last frame has to be presented again
+    if(e->type == SDL_WINDOWEVENT)
+        *repaint = true;
+    if(e->type == SDL_KEYDOWN && *pressed == NO_KEY)
     {
-    //Get the first bit
-    uint8_t bit = (byte >> bitI) & 0x1;
-    //Get the current bit on the screen
-    unsigned px = row + (7 - bitI);
-    unsigned py = col + byteI;
-
-    if(px > DISPLAY_WIDTH) px -= DISPLAY_WIDTH;
-    if(py > DISPLAY_HEIGHT) py -= DISPLAY_HEIGHT;
-
-    uint8_t *pixelbit = &DISPLAY[px][py];
-    //Set collision flag is pixel will be erased
-    if(bit == 1 && *pixelbit == 1) V[0xF] = 1;
-    //Blit the bit onto the screen buffer by XOR
-    *pixelbit = *pixelbit ^ bit;
+        for(k=0; k < 0x10; k++)
+            if(e->key.keysym.scancode == KEYPAD[k])
+                *pressed = (int)k;
     }
+    return true;
 }
-draw_flag = true;                                                                   p("Draw\n");
-})//Display n-byte starting at memory location I at (Vx, Vy), set VF = collision - reads n bytes from memory at the address I, display at (Vx, Vy). Sprites are XORed onto the screen, If this causes pixels to be erased, VF= 1 else VF=0 //sprite wrap around screen
-CREATE_INSTRUCTION(0xE09E, {if(KEY[V[X]]) PC+=2;                                    p("Skip next inst if KEY[%i] is down\n", V[X]);})//Skip next instruction if key[Vx] is PRESSED PC+=2
-CREATE_INSTRUCTION(0xE0A1, {if(!KEY[V[X]]) PC+=2;                                   p("Skip next inst if KEY[%i] is up\n", V[X]);})//Skip next instruction if key[Vx] is NOT PRESSED PC+=2
-CREATE_INSTRUCTION(0xF007, {V[X] = delay_timer;                                     p("V[%i] = delta_timer(%i)\n", X, delay_timer);})//Vx = delay timer value
-CREATE_INSTRUCTION(0xF00A, {WAIT_KEY = true;                                        p("Wait for a keypress\n");})//Wait for a key press store value of the key in Vx -All execution stops until a key is pressed, then the value of that key is stored in Vx.
-CREATE_INSTRUCTION(0xF015, {delay_timer = V[X];                                     p("delta_timer = V[%i](%i)\n", X, V[X]);})//Delay timer = Vx
-CREATE_INSTRUCTION(0xF018, {sound_timer = V[X];                                     p("sound_timer = V[%i](%i)\n", X, V[X]);})//Sound timer = Vx
-CREATE_INSTRUCTION(0xF01E, {V[0xF] = (V[X] + I_REGISTER > 0xFFF)?1:0; I_REGISTER = I_REGISTER + V[X];   p("I += V[%i](%i)\n", X, V[X]);})//I += Vx; VF is set to 1 when there is a range overflow (I+VX>0xFFF), and to 0 when there isn't.
-CREATE_INSTRUCTION(0xF029, {I_REGISTER = FONTSET_BYTES_PER_CHAR * V[X];             p("I = CharLocation(%i)\n", FONTSET_BYTES_PER_CHAR * V[X]);})//The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx
-CREATE_INSTRUCTION(0xF033, {
-    MEMORY[I_REGISTER]   = (V[X] % 1000) / 100; // hundred's digit
-    MEMORY[I_REGISTER+1] = (V[X] % 100) / 10;   // ten's digit
-    MEMORY[I_REGISTER+2] = (V[X] % 10);         // one's digit              
-                                                                                    p("Store BCD representation of Vx\n");
-})/*MEMORY the binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1,
-and the least significant digit at I plus 2. (In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I,
-the tens digit at location I+1, and the ones digit at location I+2.)
-Store BCD representation of Vx in memory locations I, I+1, and I+2.
-The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2. */
-CREATE_INSTRUCTION(0xF055, {
-    unsigned i;
-    for(i=0; i <= X; i++)
+
+#define MIN_IPS 500//slowest supported cpu speed
+#define MAX_CATCHUP_FRAMES 5//frames run back to back after a stall before the schedule is reset
+#define UNLIMITED_BATCH 1024//instructions run between deadline checks at unlimited speed
+#define IDLE_WAIT_MS 250//longest sleep while waiting for a key, bounds how late a SIGUSR1 profile dump is written
+#define REWIND_BYTES (4 * 1024 * 1024)
+#define REWIND_FRAMES (5 * 60 * TIMER_HZ)//five minutes of history
+#define DEFAULT_FRAMESKIP 10//turbo draws one frame out of this many
+
+#ifdef CHIP8_PROFILE
+//Profiled builds write CHIP8_PROFILE_FILE (or chip8_profile.json) on exit and whenever SIGUSR1 arrives
+static PROFILE profile;
+static const char *profile_path;
+#endif
+
+//The emulation side of the frame loop. In threaded mode the emulation thread owns it together with the machine
+typedef struct {
+    uint32_t ips;
+    uint32_t frameskip;
+    //Frames are scheduled against absolute deadlines (start + n/60s) so host jitter never accumulates
+    uint64_t counter_freq;
+    uint64_t start_counter;
+    uint64_t frame;
+    //Frames actually emulated. Instruction budgets are indexed by it, not by the wall clock frame, so a recording
+    //replays with the budgets it ran with however many frames the host dropped
+    uint64_t budget_frame;
+    //F5 saves the machine next to the rom, F9 loads it back, holding backspace steps back one frame per frame
+    const char *state_path;
+    REWIND *history;
+    INPUT_RECORDER recorder;
+    uint32_t input;//last input applied, hotkeys act when they go down
+    bool rewinding;
+    bool turbo;//frames run back to back, only every frameskip-th is drawn
+    bool waiting_idle;//the last sleep waited on 0xF00A with both timers stopped
+    //Idle accounting: host time spent running instructions, to price the idle loops that were skipped, and time
+    //spent blocked on 0xF00A, which used to be spent spinning
+    uint64_t execute_ticks;
+    uint64_t run_instructions;
+    uint64_t blocked_ticks;
+    uint64_t emulated_frames;
+} EMULATOR;
+
+//Hand the input of the window to the machine, `pressed` resolves a pending 0xF00A
+void ApplyInput(EMULATOR *emu, uint32_t input, int pressed)
+{
+    unsigned k;
+    uint32_t went_down = input & ~emu->input;
+    //Execute 0xF00A (WAIT FOR KEY) INSTRUCTION
+    if(chip8.WAIT_KEY && pressed != NO_KEY)
     {
-        MEMORY[I_REGISTER + i] = V[i];
+        chip8.V[chip8.X] = (uint8_t)pressed;
+        chip8.WAIT_KEY = false;
+        RecordKeyWait(&emu->recorder, chip8.V[chip8.X]);
     }
-    I_REGISTER += X+1;                                                              
-                                                                                    p("Stores V0 to VX in memory\n");
-})//Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.[d]
-CREATE_INSTRUCTION(0xF065, {
-       unsigned i;
-    for(i=0; i <= X; i++)
+    for(k=0; k < 0x10; k++)
+        chip8.KEY[k] = (input >> k) & 0x1;
+    RecordKeys(&emu->recorder, &chip8);
+
+    if((went_down & INPUT_SAVE) && !SaveStateFile(&chip8, emu->state_path))
+        SDL_ShowSimpleMessageBox(0, "Unable to save state", emu->state_path, NULL);
+    if(went_down & INPUT_LOAD)
     {
-        V[i] = MEMORY[I_REGISTER + i];
+        if(LoadStateFile(&chip8, emu->state_path))
+        {
+            if(emu->history) ClearRewind(emu->history);
+            StopRecording(&emu->recorder);//the log can't describe a jump to another state
+        }
+        else
+            SDL_ShowSimpleMessageBox(0, "Unable to load state", emu->state_path, NULL);
     }
-    I_REGISTER += X+1;                                                              
-                                                                                    p("Fills V0 to VX from memory\n");
-})//Fills V0 to VX (including VX) with values from memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
-
-
-//Fill the instruction set
-INSTRUCTION_REF INSTRUCTION_SET[INSTRUCTIONS_COUNT] = {
-    BIND_INSTRUCTION(0x00E0, 1),
-    BIND_INSTRUCTION(0x00EE, 1),
-    BIND_INSTRUCTION(0x1000, 0),
-    BIND_INSTRUCTION(0x2000, 0),
-    BIND_INSTRUCTION(0x3000, 0),
-    BIND_INSTRUCTION(0x4000, 0),
-    BIND_INSTRUCTION(0x5000, 0),
-    BIND_INSTRUCTION(0x6000, 0),
-    BIND_INSTRUCTION(0x7000, 0),
-    BIND_INSTRUCTION(0x8000, 0),
-    BIND_INSTRUCTION(0x8001, 1),
-    BIND_INSTRUCTION(0x8002, 1),
-    BIND_INSTRUCTION(0x8003, 1),
-    BIND_INSTRUCTION(0x8004, 1),
-    BIND_INSTRUCTION(0x8005, 1),
-    BIND_INSTRUCTION(0x8006, 1),
-    BIND_INSTRUCTION(0x8007, 1),
-    BIND_INSTRUCTION(0x800E, 1),
-    BIND_INSTRUCTION(0x9000, 0),
-    BIND_INSTRUCTION(0xA000, 0),
-    BIND_INSTRUCTION(0xB000, 0),
-    BIND_INSTRUCTION(0xC000, 0),
-    BIND_INSTRUCTION(0xD000, 0),
-    BIND_INSTRUCTION(0xE09E, 1),
-    BIND_INSTRUCTION(0xE0A1, 1),
-    BIND_INSTRUCTION(0xF007, 1),
-    BIND_INSTRUCTION(0xF00A, 1),
-    BIND_INSTRUCTION(0xF015, 1),
-    BIND_INSTRUCTION(0xF018, 1),
-    BIND_INSTRUCTION(0xF01E, 1),
-    BIND_INSTRUCTION(0xF029, 1),
-    BIND_INSTRUCTION(0xF033, 1),
-    BIND_INSTRUCTION(0xF055, 1),
-    BIND_INSTRUCTION(0xF065, 1)
-};
-
-
-void Execute()
+    emu->input = input;
+    emu->rewinding = emu->history && (input & INPUT_REWIND);
+    //Unlimited speed already runs as fast as the host allows
+    emu->turbo = emu->ips && (input & INPUT_TURBO);
+}
+
+//Run every frame that is due, timers tick once per emulated frame. In turbo the next frameskip frames are due at once
+//and the schedule starts again from wherever they end. Returns whether any frame ran or was rewound
+bool RunDueFrames(EMULATOR *emu)
 {
-//Opcodes are 2 byte long and stored in big-endian
-//Read 2 byte instruction from memory
-OPCODE = MEMORY[PC] << 8 | MEMORY[PC+1];
-
-//
-X = (OPCODE >> 8) & 0x000F;//A 4-bit value, the lower 4 bits of the high byte of the instruction
-Y = (OPCODE >> 4) & 0x000F;//A 4-bit value, the upper 4 bits of the low byte of the instruction
-NNN = OPCODE & 0x0FFF;//A 12-bit value, the lowest 12 bits of the instruction
-KK = OPCODE & 0x0FF;//lowest 8 bits
-N = OPCODE & 0x0F;//lowest 4 bits
-
-//Move to next instruction
-PC += 2;
-
-unsigned o;
-for(o=0; o <= INSTRUCTIONS_COUNT; o++){
-    if(o == INSTRUCTIONS_COUNT){
-            printf("Unknown instruction for opcode 0x%04x\n", OPCODE);
+    bool any_frame = false;
+    uint64_t now = SDL_GetPerformanceCounter() - emu->start_counter;
+    uint64_t due_frame = now * TIMER_HZ / emu->counter_freq;
+    bool turbo = emu->turbo && !emu->rewinding;
+    if(turbo)
+        due_frame = emu->frame + emu->frameskip - 1;
+    if(emu->waiting_idle && due_frame > emu->frame && !turbo)
+    {
+        //Frames that passed blocked on 0xF00A had nothing to run or count down: move the schedule instead of
+        //skipping frames, emulated time resumes where it stopped
+        emu->start_counter += (due_frame - emu->frame) * emu->counter_freq / TIMER_HZ;
+        due_frame = emu->frame;
+    }
+    emu->waiting_idle = false;
+    if(due_frame > emu->frame + MAX_CATCHUP_FRAMES && !turbo)
+    {
+        //The host stalled for too long, drop the backlog instead of fast forwarding through it
+        emu->frame = due_frame - MAX_CATCHUP_FRAMES;
+    }
+    while(emu->frame <= due_frame)
+    {
+        bool ok;
+        any_frame = true;
+        if(emu->rewinding)
+        {
+            //Timers come back with the state, nothing runs
+            StopRecording(&emu->recorder);
+            RewindTo(emu->history, &chip8, 1);
+            BeeperTimer(&beeper, chip8.sound_timer, emu->frame);
+            emu->frame++;
+            continue;
+        }
+        uint64_t execute_start = SDL_GetPerformanceCounter();
+        uint64_t idle_before = chip8.idle_instructions;
+        uint32_t ran = 0, batch_ran;
+        if(emu->ips)
+            ok = RunFrame(&chip8, FrameInstructionBudget(emu->ips, emu->budget_frame), &ran);
+        else
+        {
+            //Unlimited speed: keep running until the frame deadline, or until the rom settles in an idle loop
+            uint64_t deadline = emu->start_counter + (emu->frame + 1) * emu->counter_freq / TIMER_HZ;
+            do {
+                ok = RunFrame(&chip8, UNLIMITED_BATCH, &batch_ran);
+                ran += batch_ran;
+            } while(ok && !chip8.WAIT_KEY && chip8.idle_instructions == idle_before && SDL_GetPerformanceCounter() < deadline);
+        }
+        emu->execute_ticks += SDL_GetPerformanceCounter() - execute_start;
+        emu->run_instructions += ran - (chip8.idle_instructions - idle_before);
+        emu->emulated_frames++;
+        emu->budget_frame++;
+        if(!ok)
+        {
             SDL_ShowSimpleMessageBox(0, "Unknown Opcode", "Unknown opcode", NULL);
             exit(-45);
         }
-    //printf("Checking instruction for opcode 0x%04x\n", OPCODE);
-    bool instruction_found = false;
-
-    //printf("Checking instruction for opcode 0x%01x against 0x%01x\n", (OPCODE & 0xF000) , (INSTRUCTION_SET[o].opcode & 0xF000));
-    if( (OPCODE & 0xF000) == (INSTRUCTION_SET[o].opcode & 0xF000) ){//check if instruction first byte correspond
-        if(INSTRUCTION_SET[o].hasVariant) {//check if instruction has multiple definitions
-            
-            if(KK == (INSTRUCTION_SET[o].opcode & 0xFF))//check lowest 2 bytes 
-                instruction_found = true;
-
-            if(N == (INSTRUCTION_SET[o].opcode & 0xF))//check nibble if corresponds
-                instruction_found = true;
-        }   
-        else instruction_found = true;//execute instruction if found
-        
-    if(instruction_found)
-    {
-    p("PC:%i  OPCODE 0x%04x\n",PC-2, OPCODE);
-    INSTRUCTION_SET[o].func_ptr();//run instruction
-    break;
-    }
-        
+        //Fast forwarded beeps would only be clicks
+        BeeperTimer(&beeper, turbo ? 0 : chip8.sound_timer, emu->frame);
+        TickTimers(&chip8);
+        RecordFrame(&emu->recorder);
+        if(emu->history)
+            PushRewind(emu->history, &chip8);
+        emu->frame++;
     }
+    if(turbo)
+        emu->start_counter = SDL_GetPerformanceCounter() - emu->frame * emu->counter_freq / TIMER_HZ;
+#ifdef CHIP8_PROFILE
+    if(ProfileDumpRequested())
+        WriteProfile(&profile, profile_path, ProfileFormatFromPath(profile_path));
+#endif
+    return any_frame;
 }
 
+//Milliseconds until the next frame is due, or -1 when 0xF00A waits with both timers stopped: no frame can change
+//anything then, so only input (or the periodic profile dump) should end the sleep
+int FrameWait(EMULATOR *emu)
+{
+    emu->waiting_idle = chip8.WAIT_KEY && !chip8.delay_timer && !chip8.sound_timer && !emu->rewinding;
+    if(emu->waiting_idle)
+        return -1;
+    uint64_t next_deadline = emu->start_counter + emu->frame * emu->counter_freq / TIMER_HZ;
+    uint64_t counter = SDL_GetPerformanceCounter();
+    if(emu->turbo || counter >= next_deadline)
+        return 0;
+    return (int)((next_deadline - counter) * 1000 / emu->counter_freq);
+}
 
+//Threaded mode: the emulation thread runs the frame loop and publishes finished displays, the main thread handles
+//the window and presents the newest one, so a present blocked on vsync never holds back emulated time
+typedef struct {
+    EMULATOR *emu;
+    TRIPLE_BUFFER frames;
+    atomic_uint input;//last SampleInput()
+    atomic_int pressed;//first keypad key pressed since the emulation thread last looked, or NO_KEY
+    atomic_int running;
+    atomic_int frame_pending;//a frame_event is queued for the window
+    Uint32 frame_event;
+    SDL_sem *wake;//posted on input and on quit, the emulation thread sleeps on it between frames
+} EMULATION_THREAD;
+
+int EmulationThread(void *data)
+{
+    EMULATION_THREAD *thread = (EMULATION_THREAD*)data;
+    EMULATOR *emu = thread->emu;
+    while(atomic_load(&thread->running))
+    {
+        ApplyInput(emu, atomic_load(&thread->input), atomic_exchange(&thread->pressed, NO_KEY));
+        RunDueFrames(emu);
+        //Only displays that changed are published, in turbo that is checked every frameskip frames
+        if(chip8.dirty_rows)
+        {
+            chip8.dirty_rows = 0;
+            chip8.draw_flag = false;
+            PublishFrame(&thread->frames, &chip8, emu->frame);
+            if(!atomic_exchange(&thread->frame_pending, 1))
+            {
+                SDL_Event e;
+                memset(&e, 0, sizeof(e));
+                e.type = thread->frame_event;
+                SDL_PushEvent(&e);
+            }
+        }
+        int wait = FrameWait(emu);
+        if(wait < 0)
+        {
+            uint64_t counter = SDL_GetPerformanceCounter();
+            SDL_SemWaitTimeout(thread->wake, IDLE_WAIT_MS);
+            emu->blocked_ticks += SDL_GetPerformanceCounter() - counter;
+        }
+        else if(wait > 0)
+            SDL_SemWaitTimeout(thread->wake, (Uint32)wait);
+    }
+    return 0;
+}
 
-//Subtract 1 every tick (60hz)
-if(delay_timer > 0)
-    delay_timer--;
+//Single thread: input, frames, upload and present in turn
+void RunWindow(EMULATOR *emu, SCREEN *screen)
+{
+    bool repaint = true;
+    bool running = true;
+    while(running)    {
+        SDL_Event e;
+        int pressed = NO_KEY;
+        while(SDL_PollEvent(&e))
+            running = HandleEvent(&e, &repaint, &pressed) && running;
+        ApplyInput(emu, SampleInput(), pressed);
+        bool new_frame = running && RunDueFrames(emu);
+
+        //Upload only the rows the rom changed and present only when something was uploaded or the window needs a repaint
+        PresentDisplay(screen, (const uint64_t (*)[DISPLAY_ROW_WORDS])chip8.DISPLAY, chip8.hires, chip8.dirty_rows, repaint, new_frame);
+        chip8.dirty_rows = 0;
+        chip8.draw_flag = false;
+        repaint = false;
+
+        //Sleep until the next frame deadline or the next event, whichever comes first
+        int wait = FrameWait(emu);
+        if(wait < 0)
+        {
+            uint64_t counter = SDL_GetPerformanceCounter();
+            SDL_WaitEventTimeout(NULL, IDLE_WAIT_MS);
+            emu->blocked_ticks += SDL_GetPerformanceCounter() - counter;
+        }
+        else if(wait > 0)
+            SDL_WaitEventTimeout(NULL, wait);
+    }
+}
 
-if(sound_timer > 0)
-    sound_timer--;
+//Threaded mode: this thread only waits for events, input and published frames both wake it
+void RunThreadedWindow(EMULATOR *emu, SCREEN *screen)
+{
+    static EMULATION_THREAD thread;
+    static uint64_t shown[DISPLAY_HEIGHT][DISPLAY_ROW_WORDS];//display in the texture
+    bool shown_hires = false;
+    bool repaint = true;
+    bool running = true;
+    uint32_t input = 0;
+    thread.emu = emu;
+    InitTripleBuffer(&thread.frames);
+    atomic_init(&thread.input, 0);
+    atomic_init(&thread.pressed, NO_KEY);
+    atomic_init(&thread.running, 1);
+    atomic_init(&thread.frame_pending, 0);
+    thread.frame_event = SDL_RegisterEvents(1);
+    thread.wake = SDL_CreateSemaphore(0);
+    SDL_Thread *emulation_thread = thread.frame_event != (Uint32)-1 && thread.wake ? SDL_CreateThread(EmulationThread, "emulation", &thread) : NULL;
+    if(emulation_thread == NULL)
+    {
+        SDL_ShowSimpleMessageBox(0, "Unable to start the emulation thread", SDL_GetError(), NULL);
+        exit(-12);
+    }
 
-};
+    while(running)
+    {
+        SDL_Event e;
+        int pressed = NO_KEY;
+        if(SDL_WaitEventTimeout(&e, IDLE_WAIT_MS))
+        {
+            do {
+                running = HandleEvent(&e, &repaint, &pressed) && running;
+            } while(SDL_PollEvent(&e));
+        }
+        uint32_t sampled = SampleInput();
+        if(sampled != input || pressed != NO_KEY)
+        {
+            int none = NO_KEY;
+            input = sampled;
+            atomic_store(&thread.input, input);
+            if(pressed != NO_KEY)
+                atomic_compare_exchange_strong(&thread.pressed, &none, pressed);
+            if(SDL_SemValue(thread.wake) == 0)
+                SDL_SemPost(thread.wake);
+        }
 
+        //Rows are compared against what the texture holds, frames the window had no time for are dropped
+        atomic_store(&thread.frame_pending, 0);
+        const FRAME *latest = AcquireFrame(&thread.frames);
+        uint64_t dirty = 0;
+        if(latest)
+        {
+            unsigned y;
+            for(y=0; y < DISPLAY_HEIGHT; y++)
+                if(latest->hires != shown_hires || memcmp(latest->display[y], shown[y], sizeof(shown[y])) != 0)
+                    dirty |= 1ULL << y;
+            memcpy(shown, latest->display, sizeof(shown));
+            shown_hires = latest->hires;
+        }
+        PresentDisplay(screen, (const uint64_t (*)[DISPLAY_ROW_WORDS])shown, shown_hires, dirty, repaint, latest != NULL);
+        repaint = false;
+    }
 
-/* These are in charge of maintaining our sine function */
-float sinPos;
-float sinStep;
-void populate_audio(void* data, Uint8 *stream, int len) {
-	int i=0;
-    float VOLUME = 127.0;
-	for (i=0; i<len; i++) {
-		/* Just fill the stream with sine! */
-		stream[i] = (Uint8) (VOLUME * sinf(sinPos))+127.0f;
-		sinPos += sinStep;
-	}
+    atomic_store(&thread.running, 0);
+    SDL_SemPost(thread.wake);
+    SDL_WaitThread(emulation_thread, NULL);
+    SDL_DestroySemaphore(thread.wake);
+    printf("Render thread: %llu frames published, %llu presented\n",
+        (unsigned long long)thread.frames.published, (unsigned long long)screen->presented_frames);
 }
 
 int main(int argc, char *argv[])
 {
-    srand(time(NULL));
-    
+#ifdef _WIN32
     AllocConsole();
     freopen("conin$", "r", stdin);
     freopen("conout$", "w", stdout);
     freopen("conout$", "w", stderr);
+#endif
     printf("Debugging Window:\n");
 
+    //CHIP8_RENDER_THREAD=1 runs the emulation on its own thread, presents can then wait for vsync
+    bool threaded = getenv("CHIP8_RENDER_THREAD") && atoi(getenv("CHIP8_RENDER_THREAD")) != 0;
+
     //Init SDL2 and a rendenrer
     SDL_Init(SDL_INIT_EVERYTHING);
     SDL_Window* m_win = SDL_CreateWindow("Chip8 Interpreter - written by Stanislav Kirichenko", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 640, 480, 0u); 
-    SDL_Renderer *m_display = SDL_CreateRenderer(m_win, -1, SDL_RENDERER_ACCELERATED);
-
-    //Create a black texture as an output
-    SDL_Texture *bitmapTex = SDL_CreateTexture(m_display, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH, DISPLAY_HEIGHT);
-    unsigned char* pixels = NULL;    int pitch = 0;
-    if(SDL_LockTexture(bitmapTex, NULL, (void**)&pixels, &pitch ) < 0) {
-        SDL_ShowSimpleMessageBox(0, "SDL failed to access texture", SDL_GetError(), NULL); 
-        exit(-12);
-    }
-             
-    memset(pixels, 0, pitch*DISPLAY_HEIGHT);//Fill black texture
-    SDL_UnlockTexture(bitmapTex);
-
-    SDL_Surface* formattedSurf = SDL_CreateRGBSurfaceWithFormat(0, DISPLAY_WIDTH, DISPLAY_HEIGHT, 8, SDL_PIXELFORMAT_RGB888);
-
-
-    //Create a sinewave generator
+    SDL_Renderer *m_display = SDL_CreateRenderer(m_win, -1, SDL_RENDERER_ACCELERATED | (threaded ? SDL_RENDERER_PRESENTVSYNC : 0));
+
+    //Create a black texture as an output, it is recreated only when the rom switches between 64x32 and 128x64
+    SCREEN screen;
+    memset(&screen, 0, sizeof(screen));
+    screen.renderer = m_display;
+    screen.texture = CreateDisplayTexture(m_display, LORES_WIDTH, LORES_HEIGHT);
+    screen.hires = false;
+
+    //Beeper with a small device buffer, one buffer of latency keeps every beep exactly sound_timer frames long
+    unsigned audio_buffer = AUDIO_BUFFER_SAMPLES;
+    if(audio_buffer < AUDIO_MIN_BUFFER) audio_buffer = AUDIO_MIN_BUFFER;
+    if(audio_buffer > AUDIO_MAX_BUFFER) audio_buffer = AUDIO_MAX_BUFFER;
+    InitBeeper(&beeper, AUDIO_RATE, audio_buffer);
     SDL_AudioSpec audioSpec;
     /* Set up the requested settings */
-	audioSpec.freq = 44100;
+	audioSpec.freq = AUDIO_RATE;
 	audioSpec.format = AUDIO_U8;
 	audioSpec.channels = 1;
-	audioSpec.samples = 8192 ;
+	audioSpec.samples = (Uint16)audio_buffer;
 	audioSpec.callback = (*populate_audio);
-	audioSpec.userdata = NULL;
-    //init variables
-    const float mpi = 3.1415926535897963f;
-    sinPos = 0;    sinStep = 2.0f * mpi * 800.0f / 44100.0f;
+	audioSpec.userdata = &beeper;
 
     //Open audio device
     if (SDL_OpenAudio(&audioSpec, NULL) < 0){
         SDL_ShowSimpleMessageBox(0, "SDL Failed to open audio device", SDL_GetError(), NULL);   
         exit(-12);
     }
+    //The device always runs, the beeper renders silence between beeps
+    SDL_PauseAudio(0);
     
     ///Initialize chip---------------------------------------------------------------
-    //Set from counter to 0x200
-    PC          = 0x200;
-    OPCODE      = 0;
-    I_REGISTER  = 0;
-    SP          = 0;
-    draw_flag   = true;
-    delay_timer = 0;
-    sound_timer = 0;
-    //Reset memory
-    memset(MEMORY,      0, MEMORY_SIZE);
-    memset(V,           0, V_REGISTER_SIZE);
-    memset(STACK,       0, STACK_SIZE);
-    memset(DISPLAY,     0, DISPLAY_SIZE);
-    memset(KEY,         0, KEY_SIZE);
-    //Copy font set into memory
-    memcpy(MEMORY, chip8_fontset, FONTSET_BYTES_PER_CHAR * 16);
-
+    BuildDecodeTable();
+    InitChip8(&chip8);
+    uint64_t seed = (uint64_t)time(NULL);
+    SeedChip8(&chip8, seed);
 
     //Load the game into memory
+    static uint8_t rom[MAX_GAME_SIZE];
+    size_t rom_size = 0;
     if(argc > 1)
-        LoadGame(argv[1]);
+    {
+        FILE *rom_file = fopen(argv[1], "rb");
+        if(rom_file == NULL)
+        {
+            SDL_ShowSimpleMessageBox(0, "Unable to open rom", argv[1], NULL);
+            exit(42);
+        }
+        rom_size = fread(rom, 1, MAX_GAME_SIZE, rom_file);
+        fclose(rom_file);
+    }
     else
     {
         SDL_ShowSimpleMessageBox(0, "Nothing to run", "Drag a rom on top of executable", NULL);
         exit(-1);
     }
-    
- 
-
-    uint32_t rate = ((uint32_t) ((1.0f / 60.0f/*Hz*/) * 1000.0f));
 
+    //Optional quirk profile after the engine, by default the rom database picks it
+    QUIRK_PROFILE quirks = QUIRKS_DEFAULT;
+    if(argc <= 4 || strcmp(argv[4], "auto") == 0)
+    {
+        QUIRK_DATABASE database;
+        const char *database_path = getenv("CHIP8_QUIRKS_DB") ? getenv("CHIP8_QUIRKS_DB") : QUIRK_DATABASE_FILE;
+        LoadQuirkDatabase(&database, database_path);
+        if(database.count == 0)
+            printf("Quirk database %s is missing or has no entries, the rom runs with the default profile\n", database_path);
+        quirks = LookupQuirkProfile(&database, rom, rom_size, QUIRKS_DEFAULT);
+        FreeQuirkDatabase(&database);
+    }
+    else if(!ParseQuirkProfile(argv[4], &quirks))
+    {
+        SDL_ShowSimpleMessageBox(0, "Unknown quirk profile", argv[4], NULL);
+        exit(-1);
+    }
+    SetQuirkProfile(&chip8, quirks);
+    LoadGameFromBuffer(&chip8, rom, rom_size);
+    printf("Quirks: %s\n", QuirkProfileName(quirks));
+
+    //Optional engine: interpreter, blocks to run predecoded blocks, or jit to also compile hot blocks (default)
+    const char *engine = argc > 3 ? argv[3] : "jit";
+    BLOCK_CACHE *block_cache = NULL;
+    if(strcmp(engine, "interpreter") != 0)
+        block_cache = CreateBlockCache();
+    if(block_cache)
+    {
+        if(strcmp(engine, "jit") == 0)
+            block_cache->jit = CreateJit();
+        AttachBlockCache(&chip8, block_cache);
+    }
     
-    int running = 1;
-    while(running)    {
-        uint32_t time = SDL_GetTicks();
-        SDL_Event e;
-        while(SDL_PollEvent(&e) || WAIT_KEY)
-        {
-            if(e.type == SDL_QUIT)
-                running = 0;
-
-            //Execute 0xF00A (WAIT FOR KEY) INSTRUCTION
-            if(WAIT_KEY && e.type == SDL_KEYDOWN)
-            {
-                switch(e.key.keysym.scancode){
-                    case SDL_SCANCODE_1: V[X] = 0x0; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_2: V[X] = 0x1; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_3: V[X] = 0x2; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_4: V[X] = 0x3; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_Q: V[X] = 0x4; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_W: V[X] = 0x5; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_E: V[X] = 0x6; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_R: V[X] = 0x7; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_A: V[X] = 0x8; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_S: V[X] = 0x9; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_D: V[X] = 0xA; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_F: V[X] = 0xB; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_Z: V[X] = 0xC; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_X: V[X] = 0xD; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_C: V[X] = 0xE; WAIT_KEY = false; break;
-                    case SDL_SCANCODE_V: V[X] = 0xF; WAIT_KEY = false; break;
-                    default: break;
-                }
-            }
-        }
-
-        const uint8_t *key = SDL_GetKeyboardState(NULL);
-        KEY[0x0] = key[SDL_SCANCODE_1]; 
-        KEY[0x1] = key[SDL_SCANCODE_2];
-        KEY[0x2] = key[SDL_SCANCODE_3];
-        KEY[0x3] = key[SDL_SCANCODE_4];
-
-        KEY[0x4] = key[SDL_SCANCODE_Q];
-        KEY[0x5] = key[SDL_SCANCODE_W];
-        KEY[0x6] = key[SDL_SCANCODE_E];
-        KEY[0x7] = key[SDL_SCANCODE_R];
-
-        KEY[0x8] = key[SDL_SCANCODE_A];
-        KEY[0x9] = key[SDL_SCANCODE_S];
-        KEY[0xA] = key[SDL_SCANCODE_D];
-        KEY[0xB] = key[SDL_SCANCODE_F];
-
-        KEY[0xC] = key[SDL_SCANCODE_Z];
-        KEY[0xD] = key[SDL_SCANCODE_X];
-        KEY[0xE] = key[SDL_SCANCODE_C];
-        KEY[0xF] = key[SDL_SCANCODE_V];
-
-
-        time = SDL_GetTicks();
-
-        //Run the instruction
-        Execute();
+ 
 
-        if(sound_timer > 0){
-            SDL_PauseAudio(0);
-        }
-        else{
-            SDL_PauseAudio(1);
-        }
-        
+    //Optional cpu speed in instructions per second, 0 runs as fast as possible
+    uint32_t ips = DEFAULT_IPS;
+    if(argc > 2)
+        ips = (uint32_t)strtoul(argv[2], NULL, 10);
+    if(ips != 0 && ips < MIN_IPS)
+        ips = MIN_IPS;
+
+    static EMULATOR emu;
+    emu.ips = ips;
+    //CHIP8_FRAMESKIP sets how many turbo frames (Tab held) run per frame drawn
+    emu.frameskip = getenv("CHIP8_FRAMESKIP") ? (uint32_t)strtoul(getenv("CHIP8_FRAMESKIP"), NULL, 10) : DEFAULT_FRAMESKIP;
+    if(emu.frameskip == 0)
+        emu.frameskip = 1;
+    emu.counter_freq = SDL_GetPerformanceFrequency();
+    emu.start_counter = SDL_GetPerformanceCounter();
+
+    char state_path[1024];
+    snprintf(state_path, sizeof(state_path), "%s.state", argv[1]);
+    emu.state_path = state_path;
+    emu.history = CreateRewind(REWIND_BYTES, REWIND_FRAMES, REWIND_KEYFRAME_INTERVAL);
+
+    //CHIP8_RECORD_FILE records the keypad into an input log that headless -r replays, only at a fixed speed
+    const char *record_path = getenv("CHIP8_RECORD_FILE");
+    if(record_path && ips && !StartRecording(&emu.recorder, record_path, seed, ips))
+        printf("Unable to record input to %s\n", record_path);
+
+#ifdef CHIP8_PROFILE
+    //The render thread times its uploads and presents apart and adds them in at exit
+    static PROFILE render_profile;
+    profile_path = getenv("CHIP8_PROFILE_FILE") ? getenv("CHIP8_PROFILE_FILE") : "chip8_profile.json";
+    ResetProfile(&profile);
+    ResetProfile(&render_profile);
+    chip8.profile = &profile;
+    screen.profile = threaded ? &render_profile : &profile;
+    CatchProfileSignal();
+#endif
 
+    if(threaded)
+        RunThreadedWindow(&emu, &screen);
+    else
+        RunWindow(&emu, &screen);
 
-        if(draw_flag)
-        {
-            //Update texture content
-            SDL_LockTexture(bitmapTex, NULL, (void**)&pixels, &pitch );
-            //Fill black texture
-            
-            unsigned k,j;
-            for(j=0; j < DISPLAY_HEIGHT; j++)
-            for(k=0; k < DISPLAY_WIDTH; k++)
-            {
-                uint8_t bit = DISPLAY[k][j] ? 255 : 0;
-                memset(&pixels[j * pitch + k*4], bit, pitch);
-                
-            }
-            SDL_UnlockTexture(bitmapTex);
-            //set draw flag to false
-            draw_flag = false;
-        }
-    
-        SDL_RenderClear(m_display);
-        SDL_RenderCopy(m_display, bitmapTex, NULL, NULL);
-        SDL_RenderPresent(m_display);
+    if(screen.rendered_frames)
+        printf("Texture upload: %.0f bytes saved per frame on average, %llu of %llu frames presented\n",
+            (double)screen.upload_bytes_saved / screen.rendered_frames, (unsigned long long)screen.presented_frames, (unsigned long long)screen.rendered_frames);
 
+    //Skipped idle instructions are priced at what the instructions that did run cost
+    if(emu.emulated_frames)
+    {
+        double execute_seconds = (double)emu.execute_ticks / emu.counter_freq;
+        double skipped_seconds = emu.run_instructions ? execute_seconds * (double)chip8.idle_instructions / (double)emu.run_instructions : 0.0;
+        double saved_seconds = skipped_seconds + (double)emu.blocked_ticks / emu.counter_freq;
+        printf("Idle: %llu loop instructions skipped, %.2f s blocked on 0xF00A, about %.3f ms of cpu saved per emulated second\n",
+            (unsigned long long)chip8.idle_instructions, (double)emu.blocked_ticks / emu.counter_freq, saved_seconds * 1000.0 * TIMER_HZ / emu.emulated_frames);
+    }
 
-        int32_t time_to_sleep = SDL_GetTicks() - time - rate;
-        if(time_to_sleep < 0)
-        {
-        //printf("Sleep for %ims\n", time_to_sleep);
-        SDL_Delay(abs(time_to_sleep));
-        }
-            
-    
+    if(block_cache)
+    {
+        printf("Block cache: %.2f%% hits over %llu lookups, %llu invalidations\n",
+            block_cache->lookups ? 100.0 * block_cache->hits / block_cache->lookups : 0.0,
+            (unsigned long long)block_cache->lookups, (unsigned long long)block_cache->invalidations);
+        if(block_cache->jit)
+            printf("JIT: %llu blocks compiled\n", (unsigned long long)block_cache->jit->blocks_compiled);
+        DestroyJit(block_cache->jit);
+        DestroyBlockCache(block_cache);
     }
 
     //Cleanup
+    StopRecording(&emu.recorder);
+    DestroyRewind(emu.history);
+#ifdef CHIP8_PROFILE
+    if(threaded)
+        MergeProfile(&profile, &render_profile);
+    if(!WriteProfile(&profile, profile_path, ProfileFormatFromPath(profile_path)))
+        printf("Unable to write profile %s\n", profile_path);
+#endif
     SDL_CloseAudio();
-    SDL_DestroyTexture(bitmapTex);
+    SDL_DestroyTexture(screen.texture);
     SDL_DestroyRenderer(m_display);
     SDL_DestroyWindow(m_win);
     SDL_Quit();
@@ -0,0 +1,161 @@
+#include <time.h>
+#include <signal.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "profiler.h"
+
+void ResetProfile(PROFILE *profile)
+{
+    memset(profile, 0, sizeof(PROFILE));
+    profile->min_frame_instructions = UINT64_MAX;
+}
+
+uint64_t ProfileNow()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void ProfileFrame(PROFILE *profile)
+{
+    uint64_t n = profile->frame_instructions;
+    profile->frame_history[profile->history_frames++ % PROFILE_FRAME_HISTORY] = (uint32_t)n;
+    if(n < profile->min_frame_instructions) profile->min_frame_instructions = n;
+    if(n > profile->max_frame_instructions) profile->max_frame_instructions = n;
+    profile->frames++;
+    profile->frame_instructions = 0;
+}
+
+void MergeProfile(PROFILE *into, const PROFILE *from)
+{
+    unsigned i;
+    for(i=0; i < PROFILE_MAX_HANDLERS; i++)
+        into->handler_counts[i] += from->handler_counts[i];
+    for(i=0; i < 0x1000; i++)
+        into->pc_counts[i] += from->pc_counts[i];
+    for(i=0; i < PROFILE_SECTIONS; i++)
+    {
+        into->section_ns[i] += from->section_ns[i];
+        into->section_calls[i] += from->section_calls[i];
+    }
+    into->instructions += from->instructions;
+    into->frames += from->frames;
+    if(from->min_frame_instructions < into->min_frame_instructions) into->min_frame_instructions = from->min_frame_instructions;
+    if(from->max_frame_instructions > into->max_frame_instructions) into->max_frame_instructions = from->max_frame_instructions;
+}
+
+PROFILE_FORMAT ProfileFormatFromPath(const char *path)
+{
+    size_t length = strlen(path);
+    return length >= 4 && strcmp(path + length - 4, ".csv") == 0 ? PROFILE_CSV : PROFILE_JSON;
+}
+
+static volatile sig_atomic_t dump_requested = 0;
+
+#ifdef SIGUSR1
+static void OnProfileSignal(int signal_number)
+{
+    (void)signal_number;
+    dump_requested = 1;
+}
+#endif
+
+void CatchProfileSignal()
+{
+#ifdef SIGUSR1
+    signal(SIGUSR1, OnProfileSignal);
+#endif
+}
+
+bool ProfileDumpRequested()
+{
+    if(!dump_requested)
+        return false;
+    dump_requested = 0;
+    return true;
+}
+
+static const char *SECTION_NAMES[PROFILE_SECTIONS] = {"execute", "upload", "present"};
+
+//Frames still in the history, oldest first
+static void HistoryRange(const PROFILE *profile, uint64_t *first, uint64_t *count)
+{
+    *count = profile->history_frames < PROFILE_FRAME_HISTORY ? profile->history_frames : PROFILE_FRAME_HISTORY;
+    *first = profile->history_frames - *count;
+}
+
+static void WriteJson(const PROFILE *profile, FILE *file)
+{
+    uint64_t first, count, f;
+    unsigned i;
+    bool comma = false;
+    HistoryRange(profile, &first, &count);
+    fprintf(file, "{\"instructions\":%llu,\"frames\":%llu,", (unsigned long long)profile->instructions, (unsigned long long)profile->frames);
+    fprintf(file, "\"instructions_per_frame\":{\"min\":%llu,\"max\":%llu,\"mean\":%.2f,\"first_frame\":%llu,\"history\":[",
+        (unsigned long long)(profile->frames ? profile->min_frame_instructions : 0), (unsigned long long)profile->max_frame_instructions,
+        profile->frames ? (double)profile->instructions / (double)profile->frames : 0.0, (unsigned long long)first);
+    for(f=first; f < first + count; f++)
+        fprintf(file, "%s%u", f == first ? "" : ",", profile->frame_history[f % PROFILE_FRAME_HISTORY]);
+    fprintf(file, "]},\"sections\":{");
+    for(i=0; i < PROFILE_SECTIONS; i++)
+        fprintf(file, "%s\"%s\":{\"seconds\":%.6f,\"calls\":%llu}", i ? "," : "", SECTION_NAMES[i],
+            (double)profile->section_ns[i] / 1e9, (unsigned long long)profile->section_calls[i]);
+    fprintf(file, "},\"handlers\":[");
+    for(i=0; i < INSTRUCTIONS_COUNT && i < PROFILE_MAX_HANDLERS; i++)
+    {
+        fprintf(file, "%s{\"opcode\":\"0x%04X\",\"count\":%llu}", i ? "," : "", (unsigned)INSTRUCTION_SET[i].opcode, (unsigned long long)profile->handler_counts[i]);
+    }
+    fprintf(file, "],\"pc_histogram\":[");
+    for(i=0; i < 0x1000; i++)
+    {
+        if(profile->pc_counts[i] == 0)
+            continue;
+        fprintf(file, "%s{\"pc\":\"0x%03X\",\"count\":%llu}", comma ? "," : "", i, (unsigned long long)profile->pc_counts[i]);
+        comma = true;
+    }
+    fprintf(file, "]}\n");
+}
+
+//One `section,key,value` row per counter
+static void WriteCsv(const PROFILE *profile, FILE *file)
+{
+    uint64_t first, count, f;
+    unsigned i;
+    HistoryRange(profile, &first, &count);
+    fprintf(file, "section,key,value\n");
+    fprintf(file, "total,instructions,%llu\n", (unsigned long long)profile->instructions);
+    fprintf(file, "total,frames,%llu\n", (unsigned long long)profile->frames);
+    for(i=0; i < PROFILE_SECTIONS; i++)
+    {
+        fprintf(file, "seconds,%s,%.6f\n", SECTION_NAMES[i], (double)profile->section_ns[i] / 1e9);
+        fprintf(file, "calls,%s,%llu\n", SECTION_NAMES[i], (unsigned long long)profile->section_calls[i]);
+    }
+    for(i=0; i < INSTRUCTIONS_COUNT && i < PROFILE_MAX_HANDLERS; i++)
+        fprintf(file, "handler,0x%04X,%llu\n", (unsigned)INSTRUCTION_SET[i].opcode, (unsigned long long)profile->handler_counts[i]);
+    for(i=0; i < 0x1000; i++)
+        if(profile->pc_counts[i])
+            fprintf(file, "pc,0x%03X,%llu\n", i, (unsigned long long)profile->pc_counts[i]);
+    for(f=first; f < first + count; f++)
+        fprintf(file, "frame,%llu,%u\n", (unsigned long long)f, profile->frame_history[f % PROFILE_FRAME_HISTORY]);
+}
+
+bool WriteProfile(const PROFILE *profile, const char *path, PROFILE_FORMAT format)
+{
+    FILE *file = fopen(path, "w");
+    if(file == NULL)
+        return false;
+    if(format == PROFILE_CSV)
+        WriteCsv(profile, file);
+    else
+        WriteJson(profile, file);
+    return fclose(file) == 0;
+}
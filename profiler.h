@@ -0,0 +1,74 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "chip8.h"
+
+//Instrumentation, built only with -DCHIP8_PROFILE. Without it every PROFILE_* macro expands to nothing and
+//the machine carries no profiler pointer. With it, a machine that has a PROFILE attached counts every retired
+//instruction per handler and per address, the instructions of every frame, and the time spent running
+//instructions, uploading the display and presenting.
+
+#define PROFILE_MAX_HANDLERS 64//INSTRUCTION_SET entries
+#define PROFILE_FRAME_HISTORY 3600//instructions of the last minute of frames
+
+typedef enum {PROFILE_EXECUTE, PROFILE_UPLOAD, PROFILE_PRESENT, PROFILE_SECTIONS} PROFILE_SECTION;
+typedef enum {PROFILE_JSON, PROFILE_CSV} PROFILE_FORMAT;
+
+typedef struct PROFILE {
+    uint64_t handler_counts[PROFILE_MAX_HANDLERS];//indexed like INSTRUCTION_SET
+    uint64_t pc_counts[0x1000];//instructions fetched from each address
+    uint64_t instructions;
+    uint64_t frame_instructions;//retired in the frame that is running
+    uint64_t frames;
+    uint64_t min_frame_instructions;
+    uint64_t max_frame_instructions;
+    uint32_t frame_history[PROFILE_FRAME_HISTORY];//the n-th recorded frame is at n % PROFILE_FRAME_HISTORY
+    uint64_t history_frames;//frames recorded into frame_history
+    uint64_t section_ns[PROFILE_SECTIONS];
+    uint64_t section_calls[PROFILE_SECTIONS];
+} PROFILE;
+
+void ResetProfile(PROFILE *profile);
+//Monotonic clock in nanoseconds
+uint64_t ProfileNow();
+//Frame boundary, called by TickTimers()
+void ProfileFrame(PROFILE *profile);
+//Add the counters of `from` into `into`, the per-frame history is not merged
+void MergeProfile(PROFILE *into, const PROFILE *from);
+bool WriteProfile(const PROFILE *profile, const char *path, PROFILE_FORMAT format);
+//JSON unless the path ends in .csv
+PROFILE_FORMAT ProfileFormatFromPath(const char *path);
+//Make SIGUSR1 request a dump where the host has it, poll with ProfileDumpRequested() which also clears the request
+void CatchProfileSignal();
+bool ProfileDumpRequested();
+
+#ifdef CHIP8_PROFILE
+//One instruction of handler `index` fetched from `pc`
+#define PROFILE_INSTRUCTION(c8, pc, index) do { PROFILE *p_ = (c8)->profile; if(p_) {\
+    p_->handler_counts[(index)]++; p_->pc_counts[(pc) & ADDRESS_MASK]++; p_->instructions++; p_->frame_instructions++; } } while(0)
+//`count` predecoded instructions run from `pc` on
+#define PROFILE_BLOCK(c8, pc, code, count) do { PROFILE *p_ = (c8)->profile; if(p_) { unsigned i_;\
+    for(i_=0; i_ < (count); i_++) { OPERANDS o_; o_.packed = (code)[i_].operands;\
+        p_->handler_counts[DECODE_TABLE[o_.OPCODE]]++; p_->pc_counts[((pc) + 2 * i_) & ADDRESS_MASK]++; }\
+    p_->instructions += (count); p_->frame_instructions += (count); } } while(0)
+//`iterations` of the `length` instruction loop at `pc` were skipped, they count as retired
+#define PROFILE_LOOP(c8, pc, length, iterations) do { PROFILE *p_ = (c8)->profile; if(p_) { unsigned i_;\
+    for(i_=0; i_ < (length); i_++) { uint16_t a_ = ((pc) + 2 * i_) & ADDRESS_MASK;\
+        p_->handler_counts[DECODE_TABLE[(c8)->MEMORY[a_] << 8 | (c8)->MEMORY[(a_ + 1) & ADDRESS_MASK]]] += (iterations);\
+        p_->pc_counts[a_] += (iterations); }\
+    p_->instructions += (uint64_t)(length) * (iterations); p_->frame_instructions += (uint64_t)(length) * (iterations); } } while(0)
+#define PROFILE_FRAME(c8) do { if((c8)->profile) ProfileFrame((c8)->profile); } while(0)
+//Time a section: PROFILE_BEGIN(t); ... PROFILE_END(profile, PROFILE_UPLOAD, t);
+#define PROFILE_BEGIN(t) uint64_t t = ProfileNow()
+#define PROFILE_END(profile, section, t) do { PROFILE *p_ = (profile); if(p_) {\
+    p_->section_ns[(section)] += ProfileNow() - (t); p_->section_calls[(section)]++; } } while(0)
+#else
+#define PROFILE_INSTRUCTION(c8, pc, index)
+#define PROFILE_BLOCK(c8, pc, code, count)
+#define PROFILE_LOOP(c8, pc, length, iterations)
+#define PROFILE_FRAME(c8)
+#define PROFILE_BEGIN(t)
+#define PROFILE_END(profile, section, t)
+#endif
+
+#endif
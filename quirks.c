@@ -0,0 +1,95 @@
+#include "quirks.h"
+
+static const char *PROFILE_NAMES[QUIRK_PROFILES] = {"default", "vip", "chip48", "schip"};
+
+const char *QuirkProfileName(QUIRK_PROFILE profile)
+{
+    return profile < QUIRK_PROFILES ? PROFILE_NAMES[profile] : "unknown";
+}
+
+bool ParseQuirkProfile(const char *name, QUIRK_PROFILE *profile)
+{
+    unsigned p;
+    for(p=0; p < QUIRK_PROFILES; p++)
+    {
+        if(strcmp(name, PROFILE_NAMES[p]) == 0)
+        {
+            *profile = (QUIRK_PROFILE)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t HashRom(const uint8_t *rom, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for(i=0; i < size; i++)
+    {
+        hash ^= rom[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int CompareEntries(const void *a, const void *b)
+{
+    uint64_t x = ((const QUIRK_ENTRY*)a)->hash, y = ((const QUIRK_ENTRY*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+bool LoadQuirkDatabase(QUIRK_DATABASE *database, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    size_t capacity = 0;
+    char line[256];
+    database->entries = NULL;
+    database->count = 0;
+    if(file == NULL)
+        return false;
+    while(fgets(line, sizeof(line), file))
+    {
+        char *comment = strchr(line, '#');
+        char name[16];
+        unsigned long long hash;
+        QUIRK_PROFILE profile;
+        if(comment) *comment = '\0';
+        if(sscanf(line, "%llx %15s", &hash, name) != 2 || !ParseQuirkProfile(name, &profile))
+            continue;
+        if(database->count == capacity)
+        {
+            size_t grown = capacity ? capacity * 2 : 64;
+            QUIRK_ENTRY *entries = (QUIRK_ENTRY*)realloc(database->entries, grown * sizeof(QUIRK_ENTRY));
+            if(entries == NULL)
+                break;
+            database->entries = entries;
+            capacity = grown;
+        }
+        database->entries[database->count].hash = (uint64_t)hash;
+        database->entries[database->count].profile = (uint8_t)profile;
+        database->count++;
+    }
+    fclose(file);
+    if(database->count)
+        qsort(database->entries, database->count, sizeof(QUIRK_ENTRY), CompareEntries);
+    return true;
+}
+
+void FreeQuirkDatabase(QUIRK_DATABASE *database)
+{
+    free(database->entries);
+    database->entries = NULL;
+    database->count = 0;
+}
+
+QUIRK_PROFILE LookupQuirkProfile(const QUIRK_DATABASE *database, const uint8_t *rom, size_t size, QUIRK_PROFILE fallback)
+{
+    QUIRK_ENTRY key;
+    const QUIRK_ENTRY *entry;
+    if(database->count == 0)
+        return fallback;
+    key.hash = HashRom(rom, size);
+    entry = (const QUIRK_ENTRY*)bsearch(&key, database->entries, database->count, sizeof(QUIRK_ENTRY), CompareEntries);
+    return entry ? (QUIRK_PROFILE)entry->profile : fallback;
+}
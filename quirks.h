@@ -0,0 +1,32 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include "chip8.h"
+
+//Rom database: picks the quirk profile of known roms when they are loaded. A database is a text file with one rom
+//per line, `<hash> <profile> [title]`, where the hash is HashRom() in hex and the profile is a QuirkProfileName().
+//Everything after a # is a comment.
+#define QUIRK_DATABASE_FILE "quirks.txt"//default database, CHIP8_QUIRKS_DB or -Q name another one
+
+typedef struct {
+    uint64_t hash;
+    uint8_t profile;
+} QUIRK_ENTRY;
+
+typedef struct {
+    QUIRK_ENTRY *entries;//sorted by hash
+    size_t count;
+} QUIRK_DATABASE;
+
+const char *QuirkProfileName(QUIRK_PROFILE profile);
+//default, vip, chip48 or schip, false for anything else
+bool ParseQuirkProfile(const char *name, QUIRK_PROFILE *profile);
+//64-bit FNV-1a of the rom image
+uint64_t HashRom(const uint8_t *rom, size_t size);
+//Lines that don't parse are skipped, false if the file can't be read
+bool LoadQuirkDatabase(QUIRK_DATABASE *database, const char *path);
+void FreeQuirkDatabase(QUIRK_DATABASE *database);
+//Profile of a rom in the database, `fallback` for any other
+QUIRK_PROFILE LookupQuirkProfile(const QUIRK_DATABASE *database, const uint8_t *rom, size_t size, QUIRK_PROFILE fallback);
+
+#endif
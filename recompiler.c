@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "blockcache.h"
+#include "quirks.h"
+
+//Ahead-of-time recompiler: turns a rom into a C translation unit for aot.h. Code is found by following every
+//jump, call, return address and both sides of every skip from 0x200, and each basic block becomes one function.
+//Build the output against the core for a native executable of the rom:
+//  chip8_aot game.ch8 game.c && cc -O2 -I<source dir> game.c libchip8core.a -o game
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+    uint16_t count;
+} BLOCK;
+
+typedef struct {
+    uint8_t data[MAX_GAME_SIZE];
+    size_t size;
+    const char *path;
+    QUIRK_PROFILE quirks;
+    uint16_t limit;//one past the last byte of the rom in memory
+} ROM;
+
+static BLOCK blocks[MAX_GAME_SIZE];//at most one per address
+static unsigned block_count;
+static bool queued[0x1000];
+static uint16_t worklist[0x1000];
+static unsigned pending;
+static uint64_t inlined, calls;
+//QUIRK_PROFILE constants, their suffix names the profile's handlers
+static const char *const PROFILE_ENUMS[QUIRK_PROFILES] = {"QUIRKS_DEFAULT", "QUIRKS_VIP", "QUIRKS_CHIP48", "QUIRKS_SCHIP"};
+#define PROFILE_SUFFIX(quirks) (PROFILE_ENUMS[quirks] + strlen("QUIRKS_"))
+
+static void Enqueue(const ROM *rom, unsigned address)
+{
+    //Only the rom itself is compiled, anything else the program jumps to is left to the interpreter
+    if(address < 0x200 || address + 1 >= rom->limit || queued[address])
+        return;
+    queued[address] = true;
+    worklist[pending++] = (uint16_t)address;
+}
+
+static uint16_t Fetch(const CHIP8 *c8, unsigned address)
+{
+    return c8->MEMORY[address] << 8 | c8->MEMORY[address + 1];
+}
+
+//Split the block at `start` like BuildBlock() does and queue every address control can reach from its end
+static void DiscoverBlock(const CHIP8 *c8, const ROM *rom, uint16_t start)
+{
+    BLOCK *block = &blocks[block_count];
+    unsigned address = start;
+    unsigned count = 0;
+    uint32_t last = 0;
+    while(address + 1 < rom->limit)
+    {
+        uint16_t opcode = Fetch(c8, address);
+        uint8_t o = DECODE_TABLE[opcode];
+        //Unknown opcodes are left to Execute() so they are reported
+        if(o == UNKNOWN_INSTRUCTION)
+            break;
+        count++;
+        address += 2;
+        if(EndsBlock(INSTRUCTION_SET[o].opcode))
+        {
+            last = INSTRUCTION_SET[o].opcode;
+            break;
+        }
+    }
+    if(count == 0)
+        return;
+    block->start = start;
+    block->end = (uint16_t)address;
+    block->count = (uint16_t)count;
+    block_count++;
+
+    uint16_t opcode = Fetch(c8, address - 2);
+    switch(last)
+    {
+        case 0x1000:
+            Enqueue(rom, opcode & 0x0FFF);
+            break;
+        case 0x2000://the return lands right after the call
+            Enqueue(rom, opcode & 0x0FFF);
+            Enqueue(rom, address);
+            break;
+        case 0x3000: case 0x4000: case 0x5000: case 0x9000: case 0xE09E: case 0xE0A1:
+            Enqueue(rom, address);
+            Enqueue(rom, address + 2);
+            break;
+        case 0xF00A: case 0xF033: case 0xF055:
+            Enqueue(rom, address);
+            break;
+        //0x00EE goes back to a queued return address, 0xB000 is computed at run time
+    }
+}
+
+//Name of the handler the profile runs for INSTRUCTION_SET entry `o`
+static void HandlerName(char *name, size_t size, uint8_t o, QUIRK_PROFILE quirks)
+{
+    //Quirk dependent instructions are the ones with a different handler in some profile
+    bool quirk = false;
+    unsigned p;
+    for(p=0; p < QUIRK_PROFILES; p++)
+        quirk |= INSTRUCTION_SETS[p][o].func_ptr != INSTRUCTION_SET[o].func_ptr;
+    if(!quirk)
+    {
+        snprintf(name, size, "chip8_func_0x%04X", (unsigned)INSTRUCTION_SET[o].opcode);
+        return;
+    }
+    snprintf(name, size, "chip8_func_0x%04X_%s", (unsigned)INSTRUCTION_SET[o].opcode, PROFILE_SUFFIX(quirks));
+}
+
+//Instructions EmitInline() translates, every other one calls its handler
+static bool IsInline(uint32_t instruction)
+{
+    switch(instruction)
+    {
+        case 0x6000: case 0x7000: case 0xA000: case 0x8000: case 0x8001: case 0x8002: case 0x8003: case 0x8004:
+        case 0x8005: case 0x8006: case 0x8007: case 0x800E: case 0x3000: case 0x4000: case 0x5000: case 0x9000:
+        case 0x1000: case 0x2000: case 0x00EE:
+            return true;
+    }
+    return false;
+}
+
+//Emit one instruction as plain C, the same set the jit translates plus jumps, calls and returns. Returns false if it
+//has to call its handler, `wrote_pc` is set when the emitted code already stores the next PC
+static bool EmitInline(FILE *out, uint32_t instruction, OPERANDS op, uint16_t next, QUIRK_PROFILE quirks, bool *wrote_pc)
+{
+    unsigned x = op.X, y = op.Y;
+    unsigned s = (QUIRK_FLAGS[quirks] & QUIRK_SHIFT_VY) ? y : x;
+    const char *logic = instruction == 0x8001 ? "|" : instruction == 0x8002 ? "&" : "^";
+    *wrote_pc = false;
+    switch(instruction)
+    {
+        case 0x6000: fprintf(out, "    c8->V[0x%X] = 0x%02X;", x, op.KK); return true;
+        case 0x7000: fprintf(out, "    c8->V[0x%X] += 0x%02X;", x, op.KK); return true;
+        case 0xA000: fprintf(out, "    c8->I_REGISTER = 0x%03X;", op.NNN); return true;
+        case 0x8000: fprintf(out, "    c8->V[0x%X] = c8->V[0x%X];", x, y); return true;
+        case 0x8001: case 0x8002: case 0x8003:
+            fprintf(out, "    c8->V[0x%X] = c8->V[0x%X] %s c8->V[0x%X];%s", x, x, logic, y,
+                (QUIRK_FLAGS[quirks] & QUIRK_VF_RESET) ? " c8->V[0xF] = 0;" : "");
+            return true;
+        //The flag is written before the result like the handlers do, so X or Y == 0xF behave the same
+        case 0x8004:
+            fprintf(out, "    c8->V[0xF] = ((int)c8->V[0x%X] + (int)c8->V[0x%X] > 255) ? 1 : 0; c8->V[0x%X] = c8->V[0x%X] + c8->V[0x%X];", x, y, x, x, y);
+            return true;
+        case 0x8005:
+            fprintf(out, "    c8->V[0xF] = (c8->V[0x%X] > c8->V[0x%X]) ? 1 : 0; c8->V[0x%X] = c8->V[0x%X] - c8->V[0x%X];", x, y, x, x, y);
+            return true;
+        case 0x8007:
+            fprintf(out, "    c8->V[0xF] = (c8->V[0x%X] > c8->V[0x%X]) ? 1 : 0; c8->V[0x%X] = c8->V[0x%X] - c8->V[0x%X];", y, x, x, y, x);
+            return true;
+        case 0x8006:
+            fprintf(out, "    c8->V[0xF] = c8->V[0x%X] & 0x1; c8->V[0x%X] = c8->V[0x%X] >> 1;", s, x, s);
+            return true;
+        case 0x800E:
+            fprintf(out, "    c8->V[0xF] = (c8->V[0x%X] >> 7) & 0x1; c8->V[0x%X] = c8->V[0x%X] << 1;", s, x, s);
+            return true;
+        case 0x3000: case 0x4000:
+            fprintf(out, "    c8->PC = c8->V[0x%X] %s 0x%02X ? 0x%03X : 0x%03X;", x, instruction == 0x3000 ? "==" : "!=", op.KK, next + 2, next);
+            *wrote_pc = true;
+            return true;
+        case 0x5000: case 0x9000:
+            fprintf(out, "    c8->PC = c8->V[0x%X] %s c8->V[0x%X] ? 0x%03X : 0x%03X;", x, instruction == 0x5000 ? "==" : "!=", y, next + 2, next);
+            *wrote_pc = true;
+            return true;
+        case 0x1000:
+            fprintf(out, "    c8->PC = 0x%03X;", op.NNN);
+            *wrote_pc = true;
+            return true;
+        case 0x2000:
+            fprintf(out, "    c8->STACK[c8->SP++ & 0xF] = 0x%03X; c8->PC = 0x%03X;", next, op.NNN);
+            *wrote_pc = true;
+            return true;
+        case 0x00EE:
+            fprintf(out, "    c8->PC = c8->STACK[--c8->SP & 0xF];");
+            *wrote_pc = true;
+            return true;
+    }
+    return false;
+}
+
+static void EmitBlock(FILE *out, const CHIP8 *c8, const ROM *rom, const BLOCK *block)
+{
+    unsigned address;
+    uint16_t opcode = 0;
+    bool wrote_pc = false, inline_last = false, stored = false;
+    fprintf(out, "\n//0x%03X-0x%03X\nstatic void Block_%03X(CHIP8 *c8, AOT_RUNTIME *aot)\n{\n", block->start, block->end - 1, block->start);
+    for(address=block->start; address < block->end; address += 2)
+    {
+        opcode = Fetch(c8, address);
+        uint8_t o = DECODE_TABLE[opcode];
+        uint32_t instruction = INSTRUCTION_SET[o].opcode;
+        uint16_t next = (uint16_t)(address + 2);
+        inline_last = EmitInline(out, instruction, DecodeOperands(opcode), next, rom->quirks, &wrote_pc);
+        if(inline_last)
+        {
+            fprintf(out, "//0x%04X\n", opcode);
+            inlined++;
+            continue;
+        }
+        char handler[64];
+        HandlerName(handler, sizeof(handler), o, rom->quirks);
+        //Stores end blocks, so the runtime hears about one before anything else runs
+        if(instruction == 0xF033)
+            fprintf(out, "    AotStored(aot, c8->I_REGISTER, 3);\n");
+        else if(instruction == 0xF055)
+            fprintf(out, "    AotStored(aot, c8->I_REGISTER, %u);\n", ((opcode >> 8) & 0xF) + 1u);
+        stored |= instruction == 0xF033 || instruction == 0xF055;
+        fprintf(out, "    AOT_CALL(c8, 0x%04X, 0x%03X, %s);\n", opcode, next, handler);
+        wrote_pc = true;
+        calls++;
+    }
+    //Leave the fields of the last instruction and PC as Execute() would
+    if(inline_last)
+        fprintf(out, "    AOT_OPERANDS(c8, 0x%04X);\n", opcode);
+    if(!wrote_pc)
+        fprintf(out, "    c8->PC = 0x%03X;\n", block->end);
+    //Only stores report to the runtime
+    if(!stored)
+        fprintf(out, "    (void)aot;\n");
+    fprintf(out, "}\n");
+}
+
+static int CompareBlocks(const void *a, const void *b)
+{
+    return (int)((const BLOCK*)a)->start - (int)((const BLOCK*)b)->start;
+}
+
+static bool WriteProgram(const char *path, const CHIP8 *c8, const ROM *rom)
+{
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return false;
+    unsigned b, i;
+    const char *name = strrchr(rom->path, '/') ? strrchr(rom->path, '/') + 1 : rom->path;
+
+    fprintf(out, "//Recompiled by chip8_aot from %s, rom hash %016llx, quirks %s\n", name,
+        (unsigned long long)HashRom(rom->data, rom->size), QuirkProfileName(rom->quirks));
+    fprintf(out, "#include \"aot.h\"\n\n");
+    //Prototypes of every handler called
+    bool declared[0x100] = {false};
+    for(b=0; b < block_count; b++)
+    for(i=blocks[b].start; i < blocks[b].end; i += 2)
+    {
+        uint8_t o = DECODE_TABLE[Fetch(c8, i)];
+        char handler[64];
+        if(declared[o] || IsInline(INSTRUCTION_SET[o].opcode))
+            continue;
+        declared[o] = true;
+        HandlerName(handler, sizeof(handler), o, rom->quirks);
+        fprintf(out, "void %s(CHIP8 *c8);\n", handler);
+    }
+
+    fprintf(out, "\nstatic const uint8_t ROM[%u] = {", (unsigned)rom->size);
+    for(i=0; i < rom->size; i++)
+        fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", rom->data[i]);
+    fprintf(out, "\n};\n");
+
+    for(b=0; b < block_count; b++)
+        EmitBlock(out, c8, rom, &blocks[b]);
+
+    if(block_count)
+    {
+        fprintf(out, "\nstatic const AOT_BLOCK BLOCKS[%u] = {\n", block_count);
+        for(b=0; b < block_count; b++)
+            fprintf(out, "    {0x%03X, 0x%03X, %u, Block_%03X},\n", blocks[b].start, blocks[b].end, blocks[b].count, blocks[b].start);
+        fprintf(out, "};\n");
+    }
+    else
+        fprintf(out, "\n#define BLOCKS NULL\n");
+
+    fprintf(out, "\nstatic const AOT_PROGRAM PROGRAM = {\"");
+    for(i=0; name[i]; i++)
+        fprintf(out, name[i] == '"' || name[i] == '\\' ? "\\%c" : "%c", name[i]);
+    fprintf(out, "\", ROM, sizeof(ROM), %s, BLOCKS, %u};\n", PROFILE_ENUMS[rom->quirks], block_count);
+    fprintf(out, "\nint main(int argc, char *argv[])\n{\n    return AotMain(&PROGRAM, argc, argv);\n}\n");
+    return fclose(out) == 0;
+}
+
+static void PrintUsage(const char *exe)
+{
+    printf("Usage: %s <rom> <output.c> [-q profile] [-Q file]\n", exe);
+    printf("  -q profile  quirks: default, vip, chip48, schip or auto to look the rom up in the database (default auto)\n");
+    printf("  -Q file     quirk database read by -q auto (default $CHIP8_QUIRKS_DB or %s)\n", QUIRK_DATABASE_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+    static ROM rom;
+    static CHIP8 c8;
+    const char *paths[2] = {NULL, NULL};
+    unsigned path_count = 0;
+    const char *quirk_database = getenv("CHIP8_QUIRKS_DB") ? getenv("CHIP8_QUIRKS_DB") : QUIRK_DATABASE_FILE;
+    bool auto_quirks = true;
+    int a;
+    rom.quirks = QUIRKS_DEFAULT;
+    for(a=1; a < argc; a++)
+    {
+        if(strcmp(argv[a], "-q") == 0 && a + 1 < argc)
+        {
+            a++;
+            auto_quirks = strcmp(argv[a], "auto") == 0;
+            if(!auto_quirks && !ParseQuirkProfile(argv[a], &rom.quirks)) { PrintUsage(argv[0]); return 1; }
+        }
+        else if(strcmp(argv[a], "-Q") == 0 && a + 1 < argc)
+            quirk_database = argv[++a];
+        else if(argv[a][0] != '-' && path_count < 2)
+            paths[path_count++] = argv[a];
+        else { PrintUsage(argv[0]); return 1; }
+    }
+    if(path_count != 2)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(paths[0], "rb");
+    if(file == NULL)
+    {
+        fprintf(stderr, "Unable to open rom %s\n", paths[0]);
+        return 42;
+    }
+    rom.path = paths[0];
+    rom.size = fread(rom.data, 1, MAX_GAME_SIZE, file);
+    fclose(file);
+    if(rom.size == 0)
+    {
+        //There would be nothing to compile, and C has no empty arrays to hold it
+        fprintf(stderr, "Rom %s is empty\n", paths[0]);
+        return 42;
+    }
+    rom.limit = (uint16_t)(0x200 + rom.size);
+    if(auto_quirks)
+    {
+        QUIRK_DATABASE database = {NULL, 0};
+        LoadQuirkDatabase(&database, quirk_database);
+        if(database.count == 0)
+            fprintf(stderr, "Quirk database %s is missing or has no entries, the rom is compiled with the default profile\n", quirk_database);
+        rom.quirks = LookupQuirkProfile(&database, rom.data, rom.size, QUIRKS_DEFAULT);
+        FreeQuirkDatabase(&database);
+    }
+
+    BuildDecodeTable();
+    InitChip8(&c8);
+    LoadGameFromBuffer(&c8, rom.data, rom.size);
+    Enqueue(&rom, 0x200);
+    while(pending)
+        DiscoverBlock(&c8, &rom, worklist[--pending]);
+    qsort(blocks, block_count, sizeof(BLOCK), CompareBlocks);
+
+    if(!WriteProgram(paths[1], &c8, &rom))
+    {
+        fprintf(stderr, "Unable to write %s\n", paths[1]);
+        return 1;
+    }
+    printf("%s: %u blocks, %llu instructions inline, %llu handler calls, quirks %s\n", paths[1], block_count,
+        (unsigned long long)inlined, (unsigned long long)calls, QuirkProfileName(rom.quirks));
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include "replay.h"
+
+static void WriteVarint(FILE *file, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), file);
+    } while(value);
+}
+
+static void WriteLittleEndian(FILE *file, uint64_t value, unsigned bytes)
+{
+    unsigned b;
+    for(b=0; b < bytes; b++)
+        fputc((uint8_t)(value >> (b * 8)), file);
+}
+
+static void WriteEvent(INPUT_RECORDER *recorder, uint8_t tag)
+{
+    WriteVarint(recorder->file, recorder->frame - recorder->last_event);
+    fputc(tag, recorder->file);
+    recorder->last_event = recorder->frame;
+}
+
+bool StartRecording(INPUT_RECORDER *recorder, const char *path, uint64_t seed, uint32_t ips)
+{
+    recorder->file = fopen(path, "wb");
+    if(recorder->file == NULL)
+        return false;
+    recorder->frame = 0;
+    recorder->last_event = 0;
+    recorder->keys = 0;
+    fwrite(INPUT_LOG_MAGIC, 1, 4, recorder->file);
+    WriteLittleEndian(recorder->file, INPUT_LOG_VERSION, 2);
+    WriteLittleEndian(recorder->file, seed, 8);
+    WriteLittleEndian(recorder->file, ips, 4);
+    return true;
+}
+
+void RecordKeys(INPUT_RECORDER *recorder, const CHIP8 *c8)
+{
+    uint16_t keys = 0;
+    unsigned k;
+    if(recorder->file == NULL)
+        return;
+    for(k=0; k < 0x10; k++)
+        keys |= (uint16_t)((c8->KEY[k] ? 1 : 0) << k);
+    if(keys == recorder->keys)
+        return;
+    WriteEvent(recorder, INPUT_EVENT_KEYS);
+    WriteLittleEndian(recorder->file, keys, 2);
+    recorder->keys = keys;
+}
+
+void RecordKeyWait(INPUT_RECORDER *recorder, uint8_t key)
+{
+    if(recorder->file)
+        WriteEvent(recorder, key & 0xF);
+}
+
+void RecordFrame(INPUT_RECORDER *recorder)
+{
+    recorder->frame++;
+}
+
+void StopRecording(INPUT_RECORDER *recorder)
+{
+    if(recorder->file == NULL)
+        return;
+    WriteEvent(recorder, INPUT_EVENT_END);
+    fclose(recorder->file);
+    recorder->file = NULL;
+}
+
+//Decode a varint at `position`, false if the log ends first
+static bool ReadVarint(INPUT_REPLAY *replay, uint64_t *value)
+{
+    unsigned shift = 0;
+    *value = 0;
+    while(replay->position < replay->size && shift < 64)
+    {
+        uint8_t byte = replay->data[replay->position++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+            return true;
+        shift += 7;
+    }
+    return false;
+}
+
+//Read the frame of the next event, a log cut short just runs out of events
+static void NextEvent(INPUT_REPLAY *replay)
+{
+    uint64_t delta;
+    if(ReadVarint(replay, &delta) && replay->position < replay->size)
+        replay->next_event += delta;
+    else
+    {
+        replay->position = replay->size;
+        replay->next_event = UINT64_MAX;
+    }
+}
+
+bool LoadReplay(INPUT_REPLAY *replay, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    memset(replay, 0, sizeof(INPUT_REPLAY));
+    if(file == NULL)
+        return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(size < 18)
+    {
+        fclose(file);
+        return false;
+    }
+    replay->data = (uint8_t*)malloc((size_t)size);
+    replay->size = replay->data ? fread(replay->data, 1, (size_t)size, file) : 0;
+    fclose(file);
+    if(replay->size != (size_t)size || memcmp(replay->data, INPUT_LOG_MAGIC, 4) != 0
+        || (replay->data[4] | replay->data[5] << 8) != INPUT_LOG_VERSION)
+    {
+        FreeReplay(replay);
+        return false;
+    }
+    unsigned b;
+    for(b=0; b < 8; b++)
+        replay->seed |= (uint64_t)replay->data[6 + b] << (b * 8);
+    for(b=0; b < 4; b++)
+        replay->ips |= (uint32_t)replay->data[14 + b] << (b * 8);
+    replay->position = 18;
+    replay->end = UINT64_MAX;
+    NextEvent(replay);
+    return true;
+}
+
+void FreeReplay(INPUT_REPLAY *replay)
+{
+    free(replay->data);
+    replay->data = NULL;
+    replay->size = 0;
+}
+
+bool ReplayFrame(INPUT_REPLAY *replay, CHIP8 *c8)
+{
+    unsigned k;
+    while(replay->next_event == replay->frame)
+    {
+        uint8_t tag = replay->data[replay->position++];
+        if(tag < 0x10)
+        {
+            if(c8->WAIT_KEY)
+            {
+                c8->V[c8->X] = tag;
+                c8->WAIT_KEY = false;
+            }
+        }
+        else if(tag == INPUT_EVENT_KEYS && replay->position + 2 <= replay->size)
+        {
+            uint16_t keys = (uint16_t)(replay->data[replay->position] | replay->data[replay->position + 1] << 8);
+            replay->position += 2;
+            for(k=0; k < 0x10; k++)
+                c8->KEY[k] = (keys >> k) & 0x1;
+        }
+        else if(tag == INPUT_EVENT_END)
+        {
+            replay->end = replay->frame;
+            replay->position = replay->size;
+        }
+        else
+            replay->position = replay->size;//unknown tag, nothing after it can be trusted
+        NextEvent(replay);
+    }
+    if(replay->frame >= replay->end)
+        return false;
+    replay->frame++;
+    return true;
+}
+
+uint64_t HashFrame(const CHIP8 *c8, uint64_t previous)
+{
+    uint64_t hash = previous;
+    unsigned y, w, b;
+#define HASH_BYTE(v) do { hash ^= (uint8_t)(v); hash *= 0x100000001b3ULL; } while(0)
+    //Only the part the current mode shows, 64x32 runs hash the same as before the 128x64 mode existed
+    for(y=0; y < MODE_HEIGHT(c8); y++)
+    for(w=0; w < MODE_WIDTH(c8) / 64; w++)
+    for(b=0; b < 8; b++)
+        HASH_BYTE(c8->DISPLAY[y][w] >> (56 - b * 8));
+    if(c8->hires)
+        HASH_BYTE(1);
+    for(b=0; b < 0x10; b++)
+        HASH_BYTE(c8->V[b]);
+    for(b=0; b < 0x10; b++)
+    {
+        HASH_BYTE(c8->STACK[b]);
+        HASH_BYTE(c8->STACK[b] >> 8);
+    }
+    HASH_BYTE(c8->I_REGISTER); HASH_BYTE(c8->I_REGISTER >> 8);
+    HASH_BYTE(c8->PC); HASH_BYTE(c8->PC >> 8);
+    HASH_BYTE(c8->SP);
+    HASH_BYTE(c8->delay_timer);
+    HASH_BYTE(c8->sound_timer);
+#undef HASH_BYTE
+    return hash;
+}
+
+//64-bit FNV-1a over the part of the display buffer the current mode shows
+uint64_t HashDisplay(const CHIP8 *c8)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    unsigned y, w, b;
+    //Hash rows left to right so the result doesn't depend on host byte order
+    for(y=0; y < MODE_HEIGHT(c8); y++)
+    for(w=0; w < MODE_WIDTH(c8) / 64; w++)
+    for(b=0; b < 8; b++)
+    {
+        hash ^= (uint8_t)(c8->DISPLAY[y][w] >> (56 - b * 8));
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+//Name of the first piece of machine state that differs, or NULL
+const char *CompareMachines(const CHIP8 *a, const CHIP8 *b)
+{
+    if(a->PC != b->PC) return "PC";
+    if(a->I_REGISTER != b->I_REGISTER) return "I";
+    if(memcmp(a->V, b->V, sizeof(a->V)) != 0) return "V";
+    if(a->SP != b->SP || memcmp(a->STACK, b->STACK, sizeof(a->STACK)) != 0) return "stack";
+    if(a->delay_timer != b->delay_timer || a->sound_timer != b->sound_timer) return "timers";
+    if(a->WAIT_KEY != b->WAIT_KEY) return "wait key";
+    if(memcmp(a->DISPLAY, b->DISPLAY, sizeof(a->DISPLAY)) != 0) return "display";
+    if(memcmp(a->MEMORY, b->MEMORY, sizeof(a->MEMORY)) != 0) return "memory";
+    return NULL;
+}
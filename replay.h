@@ -0,0 +1,62 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "chip8.h"
+
+//Input logs: everything a run depends on besides the rom, so it can be replayed without SDL.
+//Layout: "C8IN", u16 version, u64 seed, u32 instructions per second, then events. Every event is the number of
+//frames since the previous event (LEB128) and a tag byte:
+//  0x00-0x0F  0xF00A was resolved with this key
+//  0x10       the keypad changed, a u16 mask of the held keys follows (bit k = key k)
+//  0x11       end of the recording
+//Frames are counted in TickTimers() calls, events apply before the frame they are stamped with runs.
+//Multi-byte values are little-endian.
+
+#define INPUT_LOG_MAGIC "C8IN"
+#define INPUT_LOG_VERSION 1
+#define INPUT_EVENT_KEYS 0x10
+#define INPUT_EVENT_END 0x11
+
+typedef struct {
+    FILE *file;
+    uint64_t frame;//frames completed
+    uint64_t last_event;//frame of the last event written
+    uint16_t keys;//last mask written
+} INPUT_RECORDER;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t position;//next event
+    uint64_t seed;
+    uint32_t ips;
+    uint64_t frame;//frame about to run
+    uint64_t next_event;//frame of the event at `position`
+    uint64_t end;//frame the recording ended at, UINT64_MAX if it was cut short
+} INPUT_REPLAY;
+
+bool StartRecording(INPUT_RECORDER *recorder, const char *path, uint64_t seed, uint32_t ips);
+//After the keypad was sampled, before the frames that use it run
+void RecordKeys(INPUT_RECORDER *recorder, const CHIP8 *c8);
+//0xF00A was resolved with `key`
+void RecordKeyWait(INPUT_RECORDER *recorder, uint8_t key);
+//After every TickTimers()
+void RecordFrame(INPUT_RECORDER *recorder);
+void StopRecording(INPUT_RECORDER *recorder);
+
+//Read a whole log, false if it can't be read or isn't a version INPUT_LOG_VERSION log
+bool LoadReplay(INPUT_REPLAY *replay, const char *path);
+void FreeReplay(INPUT_REPLAY *replay);
+//Apply the events of the frame about to run and move on to the next frame, returns false once every recorded
+//frame has run
+bool ReplayFrame(INPUT_REPLAY *replay, CHIP8 *c8);
+
+#define INITIAL_FRAME_HASH 0xcbf29ce484222325ULL
+//Rolling 64-bit FNV-1a of the display and registers, chained onto the hash of the previous frame
+uint64_t HashFrame(const CHIP8 *c8, uint64_t previous);
+//64-bit FNV-1a of the part of the display the current mode shows, the same on every host
+uint64_t HashDisplay(const CHIP8 *c8);
+//Name of the first piece of machine state that differs between two runs, or NULL
+const char *CompareMachines(const CHIP8 *a, const CHIP8 *b);
+
+#endif
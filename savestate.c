@@ -0,0 +1,276 @@
+#include "savestate.h"
+#include "blockcache.h"
+
+static uint8_t *Put16(uint8_t *out, uint16_t v) { out[0] = (uint8_t)v; out[1] = (uint8_t)(v >> 8); return out + 2; }
+static const uint8_t *Get16(const uint8_t *in, uint16_t *v) { *v = (uint16_t)(in[0] | in[1] << 8); return in + 2; }
+
+void SaveState(const CHIP8 *c8, uint8_t *out)
+{
+    unsigned i, b;
+    memcpy(out, SAVESTATE_MAGIC, 4); out += 4;
+    out = Put16(out, SAVESTATE_VERSION);
+    memcpy(out, c8->MEMORY, 0x1000); out += 0x1000;
+    memcpy(out, c8->V, 0x10); out += 0x10;
+    out = Put16(out, c8->I_REGISTER);
+    out = Put16(out, c8->PC);
+    for(i=0; i < 0x10; i++)
+        out = Put16(out, c8->STACK[i]);
+    *out++ = c8->SP;
+    *out++ = c8->delay_timer;
+    *out++ = c8->sound_timer;
+    for(i=0; i < DISPLAY_HEIGHT * DISPLAY_ROW_WORDS; i++)
+    for(b=0; b < 8; b++)
+        *out++ = (uint8_t)(c8->DISPLAY[i / DISPLAY_ROW_WORDS][i % DISPLAY_ROW_WORDS] >> (56 - b * 8));
+    *out++ = (uint8_t)(c8->hires ? 1 : 0);
+    *out++ = (uint8_t)(c8->WAIT_KEY ? 1 : 0);
+    *out++ = c8->X;
+    for(b=0; b < 8; b++)
+        *out++ = (uint8_t)(c8->random_state >> (b * 8));
+}
+
+bool LoadState(CHIP8 *c8, const uint8_t *state, size_t size)
+{
+    uint16_t version;
+    unsigned i, b;
+    if(size != SAVESTATE_SIZE || memcmp(state, SAVESTATE_MAGIC, 4) != 0)
+        return false;
+    state = Get16(state + 4, &version);
+    if(version != SAVESTATE_VERSION)
+        return false;
+
+    //Cached blocks are only valid for the memory they were decoded from
+    if(c8->block_cache && memcmp(c8->MEMORY, state, 0x1000) != 0)
+        ResetBlockCache(c8->block_cache);
+    memcpy(c8->MEMORY, state, 0x1000); state += 0x1000;
+    memcpy(c8->V, state, 0x10); state += 0x10;
+    state = Get16(state, &c8->I_REGISTER);
+    state = Get16(state, &c8->PC);
+    for(i=0; i < 0x10; i++)
+        state = Get16(state, &c8->STACK[i]);
+    c8->SP = *state++;
+    c8->delay_timer = *state++;
+    c8->sound_timer = *state++;
+    for(i=0; i < DISPLAY_HEIGHT * DISPLAY_ROW_WORDS; i++)
+    {
+        uint64_t word = 0;
+        for(b=0; b < 8; b++)
+            word = word << 8 | *state++;
+        c8->DISPLAY[i / DISPLAY_ROW_WORDS][i % DISPLAY_ROW_WORDS] = word;
+    }
+    c8->hires = *state++ != 0;
+    c8->WAIT_KEY = *state++ != 0;
+    c8->X = *state++;
+    c8->random_state = 0;
+    for(b=0; b < 8; b++)
+        c8->random_state |= (uint64_t)*state++ << (b * 8);
+    c8->draw_flag = true;
+    c8->dirty_rows = ALL_ROWS_DIRTY;
+    return true;
+}
+
+bool SaveStateFile(const CHIP8 *c8, const char *path)
+{
+    uint8_t state[SAVESTATE_SIZE];
+    FILE *file = fopen(path, "wb");
+    if(file == NULL)
+        return false;
+    SaveState(c8, state);
+    bool ok = fwrite(state, 1, SAVESTATE_SIZE, file) == SAVESTATE_SIZE;
+    return fclose(file) == 0 && ok;
+}
+
+bool LoadStateFile(CHIP8 *c8, const char *path)
+{
+    uint8_t state[SAVESTATE_SIZE + 1];
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        return false;
+    size_t size = fread(state, 1, sizeof(state), file);
+    fclose(file);
+    return LoadState(c8, state, size);
+}
+
+//Entries are runs of [u16 zero bytes][u16 literal bytes][literals] covering the XOR of a state against its base.
+//Zero runs shorter than MIN_ZERO_RUN stay in the literal, which bounds the output at 2x the input
+#define MIN_ZERO_RUN 4
+
+static size_t EncodeDelta(const uint8_t *state, const uint8_t *base, uint8_t *out)
+{
+    size_t i = 0, size = 0;
+    while(i < SAVESTATE_SIZE)
+    {
+        size_t zeros = 0, literal = 0;
+        while(i + zeros < SAVESTATE_SIZE && state[i + zeros] == base[i + zeros])
+            zeros++;
+        i += zeros;
+        //The literal ends at the first zero run worth its header
+        while(i + literal < SAVESTATE_SIZE)
+        {
+            size_t run = 0;
+            while(run < MIN_ZERO_RUN && i + literal + run < SAVESTATE_SIZE && state[i + literal + run] == base[i + literal + run])
+                run++;
+            if(run == MIN_ZERO_RUN || i + literal + run == SAVESTATE_SIZE)
+                break;
+            literal += run + 1;
+        }
+        Put16(out + size, (uint16_t)zeros);
+        Put16(out + size + 2, (uint16_t)literal);
+        size += 4;
+        for(; literal; literal--, i++)
+            out[size++] = state[i] ^ base[i];
+    }
+    return size;
+}
+
+//XOR an entry onto `state`
+static void ApplyDelta(uint8_t *state, const uint8_t *in, size_t size)
+{
+    const uint8_t *end = in + size;
+    uint8_t *out = state;
+    while(in < end)
+    {
+        uint16_t zeros, literal;
+        in = Get16(in, &zeros);
+        in = Get16(in, &literal);
+        out += zeros;
+        for(; literal; literal--)
+            *out++ ^= *in++;
+    }
+}
+
+REWIND *CreateRewind(size_t bytes, unsigned max_frames, unsigned keyframe_interval)
+{
+    REWIND *history = (REWIND*)calloc(1, sizeof(REWIND));
+    if(history == NULL)
+        return NULL;
+    history->data = (uint8_t*)malloc(bytes);
+    history->entries = (REWIND_ENTRY*)calloc(max_frames, sizeof(REWIND_ENTRY));
+    if(history->data == NULL || history->entries == NULL || bytes < sizeof(history->scratch_entry) || max_frames == 0)
+    {
+        DestroyRewind(history);
+        return NULL;
+    }
+    history->capacity = bytes;
+    history->max_entries = max_frames;
+    history->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+    ClearRewind(history);
+    return history;
+}
+
+void DestroyRewind(REWIND *history)
+{
+    if(history == NULL)
+        return;
+    free(history->data);
+    free(history->entries);
+    free(history);
+}
+
+void ClearRewind(REWIND *history)
+{
+    history->write = 0;
+    history->oldest = 0;
+    history->next = 0;
+}
+
+static REWIND_ENTRY *Entry(const REWIND *history, uint64_t sequence)
+{
+    return &history->entries[sequence % history->max_entries];
+}
+
+//Drop the oldest entry, and the deltas left without their keyframe with it
+static void DropOldest(REWIND *history)
+{
+    history->oldest++;
+    while(history->oldest < history->next && Entry(history, history->oldest)->keyframe < history->oldest)
+        history->oldest++;
+}
+
+//Make room for `size` contiguous bytes at the write position, dropping the oldest entries as needed
+static void Reserve(REWIND *history, size_t size)
+{
+    if(history->next - history->oldest == history->max_entries)
+        DropOldest(history);
+    for(;;)
+    {
+        if(history->oldest == history->next)
+        {
+            if(history->write + size > history->capacity)
+                history->write = 0;
+            return;
+        }
+        size_t oldest = Entry(history, history->oldest)->offset;
+        if(oldest >= history->write)
+        {
+            //The oldest entry is ahead of the write position
+            if(oldest >= history->write + size)
+                return;
+            DropOldest(history);
+        }
+        else if(history->write + size <= history->capacity)
+            return;
+        else
+            history->write = 0;
+    }
+}
+
+static void Append(REWIND *history, size_t size, uint64_t keyframe)
+{
+    REWIND_ENTRY *entry = Entry(history, history->next);
+    memcpy(history->data + history->write, history->scratch_entry, size);
+    entry->offset = (uint32_t)history->write;
+    entry->size = (uint32_t)size;
+    entry->keyframe = keyframe;
+    history->write += size;
+    history->next++;
+}
+
+void PushRewind(REWIND *history, const CHIP8 *c8)
+{
+    static const uint8_t zero[SAVESTATE_SIZE];
+    SaveState(c8, history->scratch_state);
+    bool key = history->oldest == history->next || history->keyframe < history->oldest
+        || history->next - history->keyframe >= history->keyframe_interval;
+    if(!key)
+    {
+        size_t size = EncodeDelta(history->scratch_state, history->keyframe_state, history->scratch_entry);
+        Reserve(history, size);
+        //Making room may have dropped the keyframe, then this entry has to become one
+        if(history->keyframe >= history->oldest)
+        {
+            Append(history, size, history->keyframe);
+            return;
+        }
+    }
+    size_t size = EncodeDelta(history->scratch_state, zero, history->scratch_entry);
+    Reserve(history, size);
+    history->keyframe = history->next;
+    memcpy(history->keyframe_state, history->scratch_state, SAVESTATE_SIZE);
+    Append(history, size, history->keyframe);
+}
+
+unsigned RewindDepth(const REWIND *history)
+{
+    return history->next == history->oldest ? 0 : (unsigned)(history->next - history->oldest - 1);
+}
+
+bool RewindTo(REWIND *history, CHIP8 *c8, unsigned frames)
+{
+    if(history->next == history->oldest || frames > RewindDepth(history))
+        return false;
+    uint64_t target = history->next - 1 - frames;
+    const REWIND_ENTRY *entry = Entry(history, target);
+    const REWIND_ENTRY *key = Entry(history, entry->keyframe);
+
+    memset(history->keyframe_state, 0, SAVESTATE_SIZE);
+    ApplyDelta(history->keyframe_state, history->data + key->offset, key->size);
+    memcpy(history->scratch_state, history->keyframe_state, SAVESTATE_SIZE);
+    if(entry != key)
+        ApplyDelta(history->scratch_state, history->data + entry->offset, entry->size);
+
+    //New entries continue from the restored one
+    history->keyframe = entry->keyframe;
+    history->next = target + 1;
+    history->write = entry->offset + entry->size;
+    return LoadState(c8, history->scratch_state, SAVESTATE_SIZE);
+}
@@ -0,0 +1,62 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "chip8.h"
+
+//Save states: the whole machine in a fixed-size, versioned, little-endian blob, so states move between hosts.
+//Layout: "C8ST", u16 version, MEMORY, V, I, PC, STACK, SP, delay timer, sound timer, DISPLAY words
+//(row by row, most significant byte first, leftmost pixels first), the 128x64 mode flag, WAIT_KEY, the register 0xF00A waits on and the u64 state
+//of the 0xC000 random generator.
+//Bump SAVESTATE_VERSION whenever the layout changes.
+
+#define SAVESTATE_MAGIC "C8ST"
+#define SAVESTATE_VERSION 3
+#define SAVESTATE_SIZE (4 + 2 + 0x1000 + 0x10 + 2 + 2 + 0x10 * 2 + 1 + 1 + 1 + DISPLAY_HEIGHT * DISPLAY_ROW_WORDS * 8 + 1 + 1 + 1 + 8)
+
+//Write the state of `c8` to `out`, which holds SAVESTATE_SIZE bytes
+void SaveState(const CHIP8 *c8, uint8_t *out);
+//Restore a state written by SaveState(), returns false if `size`, the magic or the version don't match.
+//Keys and the attached block cache stay with the machine, the cache is emptied if memory changed
+bool LoadState(CHIP8 *c8, const uint8_t *state, size_t size);
+bool SaveStateFile(const CHIP8 *c8, const char *path);
+bool LoadStateFile(CHIP8 *c8, const char *path);
+
+//Rewind history: one state per frame in a preallocated byte ring. Every entry is the run-length encoded XOR of
+//the state against its keyframe (a keyframe against zero), so restoring any frame decodes at most two entries.
+//When the ring is full the oldest keyframe is dropped together with every delta that refers to it
+
+#define REWIND_KEYFRAME_INTERVAL 60//frames between keyframes
+
+typedef struct {
+    uint32_t offset;//first byte in REWIND.data
+    uint32_t size;
+    uint64_t keyframe;//sequence number of the entry this one is encoded against, itself for a keyframe
+} REWIND_ENTRY;
+
+typedef struct {
+    uint8_t *data;
+    size_t capacity;
+    size_t write;//where the next entry goes
+    REWIND_ENTRY *entries;//entry of sequence number s is entries[s % max_entries]
+    unsigned max_entries;
+    uint64_t oldest;//sequence number of the oldest entry kept
+    uint64_t next;//sequence number of the next entry pushed
+    unsigned keyframe_interval;
+    uint64_t keyframe;//sequence number of the keyframe new entries are encoded against
+    uint8_t keyframe_state[SAVESTATE_SIZE];
+    uint8_t scratch_state[SAVESTATE_SIZE];
+    uint8_t scratch_entry[SAVESTATE_SIZE * 2];
+} REWIND;
+
+//`bytes` of history for at most `max_frames` frames, NULL on failure
+REWIND *CreateRewind(size_t bytes, unsigned max_frames, unsigned keyframe_interval);
+void DestroyRewind(REWIND *history);
+void ClearRewind(REWIND *history);
+//Record the state at the end of a frame
+void PushRewind(REWIND *history, const CHIP8 *c8);
+//Number of frames that can be stepped back
+unsigned RewindDepth(const REWIND *history);
+//Restore the state `frames` pushes before the newest one and forget everything newer, false if it is gone
+bool RewindTo(REWIND *history, CHIP8 *c8, unsigned frames);
+
+#endif
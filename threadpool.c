@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include "threadpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION MUTEX;
+#define MUTEX_INIT(m)    InitializeCriticalSection(m)
+#define MUTEX_DESTROY(m) DeleteCriticalSection(m)
+#define MUTEX_LOCK(m)    EnterCriticalSection(m)
+#define MUTEX_UNLOCK(m)  LeaveCriticalSection(m)
+typedef HANDLE THREAD;
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_mutex_t MUTEX;
+#define MUTEX_INIT(m)    pthread_mutex_init(m, NULL)
+#define MUTEX_DESTROY(m) pthread_mutex_destroy(m)
+#define MUTEX_LOCK(m)    pthread_mutex_lock(m)
+#define MUTEX_UNLOCK(m)  pthread_mutex_unlock(m)
+typedef pthread_t THREAD;
+#endif
+
+//Range of job indices still owned by a worker, the owner pops from the head, thieves cut from the tail
+typedef struct {
+    MUTEX lock;
+    size_t head;
+    size_t tail;
+    char padding[64];//keep queues of different workers on different cache lines
+} JOB_QUEUE;
+
+typedef struct {
+    JOB_QUEUE *queues;
+    unsigned threads;
+    JOB_FUNC func;
+    void *userdata;
+} JOB_POOL;
+
+typedef struct {
+    JOB_POOL *pool;
+    unsigned index;
+} WORKER;
+
+static int PopJob(JOB_QUEUE *queue, size_t *job)
+{
+    int found = 0;
+    MUTEX_LOCK(&queue->lock);
+    if(queue->head < queue->tail)
+    {
+        *job = queue->head++;
+        found = 1;
+    }
+    MUTEX_UNLOCK(&queue->lock);
+    return found;
+}
+
+//Move half of the jobs left in some other queue into the thief queue
+static int StealJobs(JOB_POOL *pool, unsigned thief)
+{
+    unsigned i;
+    for(i=1; i < pool->threads; i++)
+    {
+        JOB_QUEUE *victim = &pool->queues[(thief + i) % pool->threads];
+        size_t head = 0, tail = 0;
+        MUTEX_LOCK(&victim->lock);
+        if(victim->head < victim->tail)
+        {
+            size_t take = (victim->tail - victim->head + 1) / 2;
+            tail = victim->tail;
+            head = tail - take;
+            victim->tail = head;
+        }
+        MUTEX_UNLOCK(&victim->lock);
+
+        if(head < tail)
+        {
+            JOB_QUEUE *own = &pool->queues[thief];
+            MUTEX_LOCK(&own->lock);
+            own->head = head;
+            own->tail = tail;
+            MUTEX_UNLOCK(&own->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void WorkerLoop(WORKER *worker)
+{
+    JOB_POOL *pool = worker->pool;
+    size_t job;
+    for(;;)
+    {
+        while(PopJob(&pool->queues[worker->index], &job))
+            pool->func(pool->userdata, worker->index, job);
+        if(!StealJobs(pool, worker->index))
+            break;
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI WorkerEntry(LPVOID arg) { WorkerLoop((WORKER*)arg); return 0; }
+#else
+static void *WorkerEntry(void *arg) { WorkerLoop((WORKER*)arg); return NULL; }
+#endif
+
+void RunJobs(unsigned threads, size_t count, JOB_FUNC func, void *userdata)
+{
+    JOB_POOL pool;
+    unsigned i;
+    if(threads == 0)
+        threads = 1;
+    if(threads > count)
+        threads = count ? (unsigned)count : 1;
+
+    pool.threads = threads;
+    pool.func = func;
+    pool.userdata = userdata;
+    pool.queues = (JOB_QUEUE*)calloc(threads, sizeof(JOB_QUEUE));
+    WORKER *workers = (WORKER*)calloc(threads, sizeof(WORKER));
+    THREAD *handles = (THREAD*)calloc(threads, sizeof(THREAD));
+
+    //Deal out equal contiguous ranges, stealing evens out whatever runs longer
+    for(i=0; i < threads; i++)
+    {
+        MUTEX_INIT(&pool.queues[i].lock);
+        pool.queues[i].head = count * i / threads;
+        pool.queues[i].tail = count * (i + 1) / threads;
+        workers[i].pool = &pool;
+        workers[i].index = i;
+    }
+
+    for(i=1; i < threads; i++)
+    {
+#ifdef _WIN32
+        handles[i] = CreateThread(NULL, 0, WorkerEntry, &workers[i], 0, NULL);
+#else
+        pthread_create(&handles[i], NULL, WorkerEntry, &workers[i]);
+#endif
+    }
+    WorkerLoop(&workers[0]);
+    for(i=1; i < threads; i++)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], NULL);
+#endif
+    }
+
+    for(i=0; i < threads; i++)
+        MUTEX_DESTROY(&pool.queues[i].lock);
+    free(handles);
+    free(workers);
+    free(pool.queues);
+}
+
+unsigned HardwareThreads()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? (unsigned)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+#endif
+}
@@ -0,0 +1,14 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+
+//Runs `func` for every job index in [0, count) on the calling thread plus `threads - 1` helpers.
+//Jobs are dealt out in contiguous ranges, a worker that runs dry steals half of the remaining range of another one.
+typedef void (*JOB_FUNC)(void *userdata, unsigned worker, size_t job);
+void RunJobs(unsigned threads, size_t count, JOB_FUNC func, void *userdata);
+
+//Number of hardware threads available to the process
+unsigned HardwareThreads();
+
+#endif
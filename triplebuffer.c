@@ -0,0 +1,31 @@
+#include "triplebuffer.h"
+
+void InitTripleBuffer(TRIPLE_BUFFER *buffer)
+{
+    memset(buffer, 0, sizeof(TRIPLE_BUFFER));
+    buffer->back = 0;
+    atomic_init(&buffer->shared, 1);
+    buffer->front = 2;
+}
+
+void PublishFrame(TRIPLE_BUFFER *buffer, const CHIP8 *c8, uint64_t frame)
+{
+    FRAME *slot = &buffer->slots[buffer->back];
+    memcpy(slot->display, c8->DISPLAY, DISPLAY_SIZE);
+    slot->hires = c8->hires;
+    slot->frame = frame;
+    //Release the slot to the reader, acquire whichever slot was in between, the reader is done with it
+    unsigned previous = atomic_exchange_explicit(&buffer->shared, buffer->back | FRAME_FRESH, memory_order_acq_rel);
+    buffer->back = previous & ~FRAME_FRESH;
+    buffer->published++;
+}
+
+const FRAME *AcquireFrame(TRIPLE_BUFFER *buffer)
+{
+    if(!(atomic_load_explicit(&buffer->shared, memory_order_relaxed) & FRAME_FRESH))
+        return NULL;
+    unsigned previous = atomic_exchange_explicit(&buffer->shared, buffer->front, memory_order_acq_rel);
+    buffer->front = previous & ~FRAME_FRESH;
+    buffer->acquired++;
+    return &buffer->slots[buffer->front];
+}
@@ -0,0 +1,41 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <stdatomic.h>
+#include "chip8.h"
+
+//Finished frames from the emulation thread to the render thread without locks. Of the three slots the writer owns
+//one, the reader owns one and the third is swapped atomically with either side: the writer never waits, and the
+//reader always gets the newest published frame, frames it had no time for are dropped.
+
+#define FRAME_FRESH 0x4//set in `shared` while its slot holds a frame the reader hasn't taken
+
+typedef struct {
+    uint64_t display[DISPLAY_HEIGHT][DISPLAY_ROW_WORDS];
+    bool hires;
+    uint64_t frame;//emulated frames completed when the display was taken
+} FRAME;
+
+typedef struct {
+    FRAME slots[3];
+    atomic_uint shared;//index of the slot in between | FRAME_FRESH
+    char shared_padding[64];
+
+    //Emulation thread
+    unsigned back;
+    uint64_t published;
+    char back_padding[64];
+
+    //Render thread
+    unsigned front;
+    uint64_t acquired;
+} TRIPLE_BUFFER;
+
+void InitTripleBuffer(TRIPLE_BUFFER *buffer);
+//Emulation thread: copy the display of `c8` after `frame` frames into the back slot and swap it in between
+void PublishFrame(TRIPLE_BUFFER *buffer, const CHIP8 *c8, uint64_t frame);
+//Render thread: the newest published frame, or NULL if nothing was published since the last call. The frame stays
+//valid until the next call
+const FRAME *AcquireFrame(TRIPLE_BUFFER *buffer);
+
+#endif